@@ -0,0 +1,550 @@
+/*******************************************************************************
+ * binary.c
+ *
+ *      Summing raw binary numbers (doubles, floats, 64 or 32-bit integers),
+ *      for producers that would otherwise have to print them as text just
+ *      for us to parse them back.  The sums are done by vectorized kernels
+ *      (AVX2 or SSE2, whichever the CPU has, picked at run time) with a plain
+ *      C fallback, so this goes about as fast as memory can feed it.
+ *
+ *      Floats are added up as doubles, and integers as 64-bit integers (which
+ *      wrap around if the total overflows).
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ttab_internal.h"
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/*  Records byte-swapped at a time when the data isn't in our byte order */
+#define SWAP_CHUNK 4096
+
+
+/*  Both kinds of total; only one gets used, depending on the type */
+struct binary_total {
+    double real;
+    int64_t integer;
+};
+
+typedef void (*binary_kernel)(const unsigned char *data, size_t count,
+        struct binary_total *total);
+
+
+/*******************************************************************************
+ *                          PLAIN C KERNELS
+*******************************************************************************/
+
+static void sum_f64_scalar(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    double value = 0;
+    double sum = 0;
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        memcpy(&value, data + i * 8, 8);
+        sum += value;
+    }
+
+    total->real += sum;
+}
+
+static void sum_f32_scalar(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    float value = 0;
+    double sum = 0;
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        memcpy(&value, data + i * 4, 4);
+        sum += value;
+    }
+
+    total->real += sum;
+}
+
+static void sum_i64_scalar(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    int64_t value = 0;
+    uint64_t sum = 0;       //  Unsigned, so overflow wraps instead of being UB
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        memcpy(&value, data + i * 8, 8);
+        sum += (uint64_t)value;
+    }
+
+    total->integer += (int64_t)sum;
+}
+
+static void sum_i32_scalar(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    int32_t value = 0;
+    int64_t sum = 0;
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        memcpy(&value, data + i * 4, 4);
+        sum += value;
+    }
+
+    total->integer += sum;
+}
+
+
+/*******************************************************************************
+ *                          SSE2 / AVX2 KERNELS
+ *
+ *      Each one keeps several accumulators going so the additions don't all
+ *      wait on each other, and leaves whatever doesn't fill a whole vector to
+ *      the plain C kernel.
+*******************************************************************************/
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void sum_f64_sse2(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    __m128d a = _mm_setzero_pd(), b = _mm_setzero_pd();
+    double lanes[2];
+    size_t i = 0;
+
+    for( ; i + 4 <= count; i += 4 )
+    {
+        const double *p = (const double *)(data + i * 8);
+        a = _mm_add_pd(a, _mm_loadu_pd(p));
+        b = _mm_add_pd(b, _mm_loadu_pd(p + 2));
+    }
+
+    _mm_storeu_pd(lanes, _mm_add_pd(a, b));
+    total->real += lanes[0] + lanes[1];
+    sum_f64_scalar(data + i * 8, count - i, total);
+}
+
+__attribute__((target("sse2")))
+static void sum_f32_sse2(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    __m128d a = _mm_setzero_pd(), b = _mm_setzero_pd();
+    __m128 value;
+    double lanes[2];
+    size_t i = 0;
+
+    for( ; i + 4 <= count; i += 4 )
+    {
+        value = _mm_loadu_ps( (const float *)(data + i * 4) );
+        a = _mm_add_pd(a, _mm_cvtps_pd(value));
+        b = _mm_add_pd(b, _mm_cvtps_pd( _mm_movehl_ps(value, value) ));
+    }
+
+    _mm_storeu_pd(lanes, _mm_add_pd(a, b));
+    total->real += lanes[0] + lanes[1];
+    sum_f32_scalar(data + i * 4, count - i, total);
+}
+
+__attribute__((target("sse2")))
+static void sum_i64_sse2(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    __m128i a = _mm_setzero_si128(), b = _mm_setzero_si128();
+    int64_t lanes[2];
+    size_t i = 0;
+
+    for( ; i + 4 <= count; i += 4 )
+    {
+        const __m128i *p = (const __m128i *)(data + i * 8);
+        a = _mm_add_epi64(a, _mm_loadu_si128(p));
+        b = _mm_add_epi64(b, _mm_loadu_si128(p + 1));
+    }
+
+    _mm_storeu_si128( (__m128i *)lanes, _mm_add_epi64(a, b) );
+    total->integer += (int64_t)( (uint64_t)lanes[0] + (uint64_t)lanes[1] );
+    sum_i64_scalar(data + i * 8, count - i, total);
+}
+
+__attribute__((target("sse2")))
+static void sum_i32_sse2(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    __m128i a = _mm_setzero_si128(), b = _mm_setzero_si128();
+    __m128i value, sign;
+    int64_t lanes[2];
+    size_t i = 0;
+
+    /*  SSE2 can't sign-extend to 64 bits itself; pair each with its sign */
+    for( ; i + 4 <= count; i += 4 )
+    {
+        value = _mm_loadu_si128( (const __m128i *)(data + i * 4) );
+        sign = _mm_srai_epi32(value, 31);
+        a = _mm_add_epi64(a, _mm_unpacklo_epi32(value, sign));
+        b = _mm_add_epi64(b, _mm_unpackhi_epi32(value, sign));
+    }
+
+    _mm_storeu_si128( (__m128i *)lanes, _mm_add_epi64(a, b) );
+    total->integer += lanes[0] + lanes[1];
+    sum_i32_scalar(data + i * 4, count - i, total);
+}
+
+__attribute__((target("avx2")))
+static void sum_f64_avx2(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    __m256d a = _mm256_setzero_pd(), b = _mm256_setzero_pd();
+    __m256d c = _mm256_setzero_pd(), d = _mm256_setzero_pd();
+    double lanes[4];
+    size_t i = 0;
+
+    for( ; i + 16 <= count; i += 16 )
+    {
+        const double *p = (const double *)(data + i * 8);
+        a = _mm256_add_pd(a, _mm256_loadu_pd(p));
+        b = _mm256_add_pd(b, _mm256_loadu_pd(p + 4));
+        c = _mm256_add_pd(c, _mm256_loadu_pd(p + 8));
+        d = _mm256_add_pd(d, _mm256_loadu_pd(p + 12));
+    }
+
+    _mm256_storeu_pd(lanes, _mm256_add_pd( _mm256_add_pd(a, b),
+                _mm256_add_pd(c, d) ));
+    total->real += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    sum_f64_scalar(data + i * 8, count - i, total);
+}
+
+__attribute__((target("avx2")))
+static void sum_f32_avx2(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    __m256d a = _mm256_setzero_pd(), b = _mm256_setzero_pd();
+    __m256d c = _mm256_setzero_pd(), d = _mm256_setzero_pd();
+    __m256 low, high;
+    double lanes[4];
+    size_t i = 0;
+
+    for( ; i + 16 <= count; i += 16 )
+    {
+        low = _mm256_loadu_ps( (const float *)(data + i * 4) );
+        high = _mm256_loadu_ps( (const float *)(data + i * 4 + 32) );
+        a = _mm256_add_pd(a, _mm256_cvtps_pd( _mm256_castps256_ps128(low) ));
+        b = _mm256_add_pd(b, _mm256_cvtps_pd( _mm256_extractf128_ps(low, 1) ));
+        c = _mm256_add_pd(c, _mm256_cvtps_pd( _mm256_castps256_ps128(high) ));
+        d = _mm256_add_pd(d, _mm256_cvtps_pd( _mm256_extractf128_ps(high, 1) ));
+    }
+
+    _mm256_storeu_pd(lanes, _mm256_add_pd( _mm256_add_pd(a, b),
+                _mm256_add_pd(c, d) ));
+    total->real += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    sum_f32_scalar(data + i * 4, count - i, total);
+}
+
+__attribute__((target("avx2")))
+static void sum_i64_avx2(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    __m256i a = _mm256_setzero_si256(), b = _mm256_setzero_si256();
+    int64_t lanes[4];
+    size_t i = 0;
+
+    for( ; i + 8 <= count; i += 8 )
+    {
+        const __m256i *p = (const __m256i *)(data + i * 8);
+        a = _mm256_add_epi64(a, _mm256_loadu_si256(p));
+        b = _mm256_add_epi64(b, _mm256_loadu_si256(p + 1));
+    }
+
+    _mm256_storeu_si256( (__m256i *)lanes, _mm256_add_epi64(a, b) );
+    total->integer += (int64_t)( (uint64_t)lanes[0] + (uint64_t)lanes[1] +
+            (uint64_t)lanes[2] + (uint64_t)lanes[3] );
+    sum_i64_scalar(data + i * 8, count - i, total);
+}
+
+__attribute__((target("avx2")))
+static void sum_i32_avx2(const unsigned char *data, size_t count,
+        struct binary_total *total)
+{
+    __m256i a = _mm256_setzero_si256(), b = _mm256_setzero_si256();
+    int64_t lanes[4];
+    size_t i = 0;
+
+    for( ; i + 8 <= count; i += 8 )
+    {
+        const __m128i *p = (const __m128i *)(data + i * 4);
+        a = _mm256_add_epi64(a, _mm256_cvtepi32_epi64( _mm_loadu_si128(p) ));
+        b = _mm256_add_epi64(b,
+                _mm256_cvtepi32_epi64( _mm_loadu_si128(p + 1) ));
+    }
+
+    _mm256_storeu_si256( (__m256i *)lanes, _mm256_add_epi64(a, b) );
+    total->integer += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    sum_i32_scalar(data + i * 4, count - i, total);
+}
+
+#endif  /*  HAVE_X86_KERNELS */
+
+
+/*  Picks the fastest kernel this CPU can run for the type */
+static binary_kernel pick_kernel(int type)
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+
+    if( __builtin_cpu_supports("avx2") )
+    {
+        switch( type )
+        {
+            case TTAB_BINARY_F64:   return(sum_f64_avx2);
+            case TTAB_BINARY_F32:   return(sum_f32_avx2);
+            case TTAB_BINARY_I64:   return(sum_i64_avx2);
+            case TTAB_BINARY_I32:   return(sum_i32_avx2);
+        }
+    }
+
+    if( __builtin_cpu_supports("sse2") )
+    {
+        switch( type )
+        {
+            case TTAB_BINARY_F64:   return(sum_f64_sse2);
+            case TTAB_BINARY_F32:   return(sum_f32_sse2);
+            case TTAB_BINARY_I64:   return(sum_i64_sse2);
+            case TTAB_BINARY_I32:   return(sum_i32_sse2);
+        }
+    }
+#endif
+
+    switch( type )
+    {
+        case TTAB_BINARY_F64:   return(sum_f64_scalar);
+        case TTAB_BINARY_F32:   return(sum_f32_scalar);
+        case TTAB_BINARY_I64:   return(sum_i64_scalar);
+        case TTAB_BINARY_I32:   return(sum_i32_scalar);
+    }
+
+    return(NULL);
+}
+
+
+int ttab_binary_width(int type)
+{
+    switch( type )
+    {
+        case TTAB_BINARY_F64:
+        case TTAB_BINARY_I64:
+            return(8);
+        case TTAB_BINARY_F32:
+        case TTAB_BINARY_I32:
+            return(4);
+    }
+
+    return(0);
+}
+
+
+int ttab_binary_type(const char *name)
+{
+    if( strcmp(name, "f64") == 0 )
+        return(TTAB_BINARY_F64);
+    if( strcmp(name, "f32") == 0 )
+        return(TTAB_BINARY_F32);
+    if( strcmp(name, "i64") == 0 )
+        return(TTAB_BINARY_I64);
+    if( strcmp(name, "i32") == 0 )
+        return(TTAB_BINARY_I32);
+
+    return(-1);
+}
+
+
+/*  Whether data in the given byte order has to be swapped to match ours */
+static int needs_swap(int byteOrder)
+{
+    const uint16_t probe = 1;
+    int bigEndian = ( *(const unsigned char *)&probe == 0 );
+
+    if( byteOrder == TTAB_ORDER_NATIVE )
+        return(0);
+    return( (byteOrder == TTAB_ORDER_BIG) != bigEndian );
+}
+
+
+/*
+ * Sums whole records, swapping their bytes first (a chunk at a time, into
+ * 'scratch') if they aren't in our byte order
+ */
+static void sum_records(const unsigned char *data, size_t count, int width,
+        int swap, binary_kernel kernel, unsigned char *scratch,
+        struct binary_total *total)
+{
+    size_t chunk = 0;
+
+    if( !swap )
+    {
+        kernel(data, count, total);
+        return;
+    }
+
+    while( count > 0 )
+    {
+        chunk = (count < SWAP_CHUNK) ? count : SWAP_CHUNK;
+
+        for( size_t i = 0; i < chunk; ++i )
+        {
+            const unsigned char *from = data + i * width;
+            unsigned char *to = scratch + i * width;
+            for( int b = 0; b < width; ++b )
+                to[b] = from[width - 1 - b];
+        }
+
+        kernel(scratch, chunk, total);
+        data += chunk * width;
+        count -= chunk;
+    }
+}
+
+
+static double final_total(int type, const struct binary_total *total)
+{
+    if( type == TTAB_BINARY_I64 || type == TTAB_BINARY_I32 )
+        return( (double)total->integer );
+    return( total->real );
+}
+
+
+int ttab_sum_binary_buffer(const void *buf, size_t len, int type,
+        int byteOrder, double *total, size_t *leftover)
+{
+    struct binary_total sum = { 0, 0 };
+    binary_kernel kernel = pick_kernel(type);
+    int width = ttab_binary_width(type);
+    int swap = 0;
+    unsigned char *scratch = NULL;
+
+    if( kernel == NULL || width == 0 )
+    {
+        errno = EINVAL;
+        return(-1);
+    }
+
+    swap = needs_swap(byteOrder);
+    if( swap )
+    {
+        scratch = malloc(SWAP_CHUNK * width);
+        if( scratch == NULL )
+            return(-1);
+    }
+
+    sum_records(buf, len / width, width, swap, kernel, scratch, &sum);
+    free(scratch);
+
+    *total = final_total(type, &sum);
+    if( leftover != NULL )
+        *leftover = len % width;
+
+    return(0);
+}
+
+
+int ttab_sum_binary_fd(int fd, int type, int byteOrder, double *total,
+        size_t *leftover)
+{
+    struct binary_total sum = { 0, 0 };
+    struct stat info;
+    binary_kernel kernel = pick_kernel(type);
+    int width = ttab_binary_width(type);
+    int swap = 0;
+    unsigned char *block = NULL;
+    unsigned char *scratch = NULL;
+    size_t blockSize = 0;
+    size_t have = 0;
+    size_t whole = 0;
+    ssize_t bytesRead = 0;
+    int status = 0;
+
+    if( kernel == NULL || width == 0 )
+    {
+        errno = EINVAL;
+        return(-1);
+    }
+
+    /*
+     * Regular files get mapped and summed in one go, unless something's
+     * already read part of one, in which case we read on from there
+     */
+    if( fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 &&
+            lseek(fd, 0, SEEK_CUR) == 0 )
+    {
+        block = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if( block != MAP_FAILED )
+        {
+            madvise(block, info.st_size, MADV_SEQUENTIAL);
+            status = ttab_sum_binary_buffer(block, info.st_size, type,
+                    byteOrder, total, leftover);
+            munmap(block, info.st_size);
+            lseek(fd, info.st_size, SEEK_SET);
+            return(status);
+        }
+    }
+
+    swap = needs_swap(byteOrder);
+
+    /*  Block size is rounded down to whole records, to keep loads aligned */
+    blockSize = ttab_read_block_size(fd);
+    blockSize -= blockSize % width;
+
+    block = malloc(blockSize);
+    if( swap )
+        scratch = malloc(SWAP_CHUNK * width);
+    if( block == NULL || (swap && scratch == NULL) )
+    {
+        free(block);
+        free(scratch);
+        return(-1);
+    }
+
+    /*
+     * Reads can end partway through a record (pipes don't care about our
+     * record size), so the odd bytes at the end of one block get moved to
+     * the front of the next
+     */
+    while(1)
+    {
+        bytesRead = read(fd, block + have, blockSize - have);
+        if( bytesRead < 0 && errno == EINTR )
+            continue;
+        if( bytesRead < 0 )
+        {
+            status = -1;
+            break;
+        }
+        if( bytesRead == 0 )
+            break;
+
+        have += bytesRead;
+        whole = have / width;
+        sum_records(block, whole, width, swap, kernel, scratch, &sum);
+
+        memmove(block, block + whole * width, have - whole * width);
+        have -= whole * width;
+    }
+
+    free(block);
+    free(scratch);
+
+    if( status == 0 )
+    {
+        *total = final_total(type, &sum);
+        if( leftover != NULL )
+            *leftover = have;
+    }
+
+    return(status);
+}
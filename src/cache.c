@@ -0,0 +1,290 @@
+/*******************************************************************************
+ * cache.c
+ *
+ *      Incremental summing of files that only ever get added to (ledgers,
+ *      logs and the like).  After each run we leave a small cache file behind
+ *      saying how far into the file we got, along with the parser's state
+ *      there (total, format, any unfinished line).  Next time, only the bytes
+ *      added since then need reading.
+ *
+ *      Caches are kept one per file, named after a hash of the file's full
+ *      path, in $XDG_CACHE_HOME/ttab (or ~/.cache/ttab) unless the caller
+ *      says otherwise.  A cache is only trusted if the file is still the same
+ *      one (device and inode), hasn't shrunk, and the bytes just before where
+ *      we left off are the same as they were; otherwise we start over.
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ttab_internal.h"
+
+#define CACHE_MAGIC "TTAB CACHE 1"
+
+/*  How many bytes before the offset get checked for the file being redone */
+#define TAIL_BYTES 64
+
+#define CACHE_BLOCK_SIZE (1024 * 1024)
+
+
+/*  What the cache remembers about the file, besides the parser's state */
+struct file_record {
+    unsigned long long device;
+    unsigned long long inode;
+    long long size;                 //  Bytes consumed so far
+    long long seconds;              //  Modification time when we read it
+    long long nanoseconds;
+    unsigned long long tailHash;    //  Hash of the bytes leading up to 'size'
+};
+
+
+/*  64-bit FNV-1a; plenty for telling files and file contents apart */
+static uint64_t fnv1a(const void *data, size_t len, uint64_t hash)
+{
+    const unsigned char *bytes = data;
+
+    for( size_t i = 0; i < len; ++i )
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return(hash);
+}
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+
+
+/*  Hashes the (up to) TAIL_BYTES bytes just before 'offset' */
+static int tail_hash(int fd, off_t offset, unsigned long long *hash)
+{
+    unsigned char tail[ TAIL_BYTES ];
+    size_t len = (offset < TAIL_BYTES) ? (size_t)offset : TAIL_BYTES;
+
+    if( pread(fd, tail, len, offset - len) != (ssize_t)len )
+        return(-1);
+
+    *hash = fnv1a(tail, len, FNV_OFFSET_BASIS);
+    return(0);
+}
+
+
+/*
+ * Works out the cache directory (creating the default one if need be) and
+ * the name of the cache file for 'realPath' within it
+ */
+static int cache_location(const char *cacheDir, const char *realPath,
+        char *cachePath, size_t size)
+{
+    char defaultDir[ PATH_MAX ];
+    const char *base = getenv("XDG_CACHE_HOME");
+    int written = 0;
+
+    if( cacheDir == NULL )
+    {
+        if( base != NULL && base[0] != '\0' )
+            written = snprintf(defaultDir, sizeof(defaultDir), "%s", base);
+        else if( (base = getenv("HOME")) != NULL )
+            written = snprintf(defaultDir, sizeof(defaultDir), "%s/.cache",
+                    base);
+        else
+        {
+            errno = ENOENT;
+            return(-1);
+        }
+
+        if( written < 0 || (size_t)written + 6 > sizeof(defaultDir) )
+        {
+            errno = ENAMETOOLONG;
+            return(-1);
+        }
+
+        mkdir(defaultDir, 0700);
+        strcat(defaultDir, "/ttab");
+        if( mkdir(defaultDir, 0700) != 0 && errno != EEXIST )
+            return(-1);
+
+        cacheDir = defaultDir;
+    }
+
+    written = snprintf(cachePath, size, "%s/%016llx.cache", cacheDir,
+            (unsigned long long)fnv1a(realPath, strlen(realPath),
+                FNV_OFFSET_BASIS));
+    if( written < 0 || (size_t)written >= size )
+    {
+        errno = ENAMETOOLONG;
+        return(-1);
+    }
+
+    return(0);
+}
+
+
+/*
+ * Loads the cache into 'record' and 'parser', if there is one and it was
+ * written for the file at 'realPath'.  Returns 0 if it loaded.
+ */
+static int load_cache(const char *cachePath, const char *realPath,
+        struct file_record *record, struct ttab_parser *parser)
+{
+    FILE *fp = NULL;
+    char magic[ sizeof(CACHE_MAGIC) ];
+    char path[ PATH_MAX + 1 ];
+    int status = -1;
+
+    fp = fopen(cachePath, "r");
+    if( fp == NULL )
+        return(-1);
+
+    if( fgets(magic, sizeof(magic), fp) != NULL &&
+            strcmp(magic, CACHE_MAGIC) == 0 && fgetc(fp) == '\n' &&
+            fgets(path, sizeof(path), fp) != NULL )
+    {
+        path[ strcspn(path, "\n") ] = '\0';
+
+        if( strcmp(path, realPath) == 0 &&
+                fscanf(fp, "%llu %llu %lld %lld %lld %llx", &record->device,
+                    &record->inode, &record->size, &record->seconds,
+                    &record->nanoseconds, &record->tailHash) == 6 &&
+                fgetc(fp) == '\n' )
+            status = ttab_parser_load_state(parser, fp);
+    }
+
+    fclose(fp);
+    return(status);
+}
+
+
+/*  Writes the cache out; losing it only costs a full read next time */
+static void save_cache(const char *cachePath, const char *realPath,
+        const struct file_record *record, const struct ttab_parser *parser)
+{
+    char tempPath[ strlen(cachePath) + 5 ];
+    FILE *fp = NULL;
+    int status = 0;
+
+    sprintf(tempPath, "%s.tmp", cachePath);
+    fp = fopen(tempPath, "w");
+    if( fp == NULL )
+        return;
+
+    fprintf(fp, "%s\n%s\n", CACHE_MAGIC, realPath);
+    fprintf(fp, "%llu %llu %lld %lld %lld %llx\n", record->device,
+            record->inode, record->size, record->seconds,
+            record->nanoseconds, record->tailHash);
+    status = ttab_parser_save_state(parser, fp);
+
+    if( fclose(fp) != 0 || status != 0 || rename(tempPath, cachePath) != 0 )
+        remove(tempPath);
+}
+
+
+int ttab_sum_incremental(const char *path, const char *cacheDir,
+        double *total)
+{
+    struct ttab_parser *parser = NULL;
+    struct file_record cached;
+    struct file_record current;
+    struct stat info;
+    char realPath[ PATH_MAX ];
+    char cachePath[ PATH_MAX ];
+    char *block = NULL;
+    ssize_t bytesRead = 0;
+    unsigned long long hash = 0;
+    off_t offset = 0;
+    int fd = -1;
+    int status = 0;
+
+    if( realpath(path, realPath) == NULL )
+        return(-1);
+
+    fd = open(realPath, O_RDONLY);
+    if( fd < 0 )
+        return(-1);
+
+    parser = ttab_parser_new();
+    if( parser == NULL || fstat(fd, &info) != 0 ||
+            cache_location(cacheDir, realPath, cachePath,
+                sizeof(cachePath)) != 0 )
+    {
+        ttab_parser_free(parser);
+        close(fd);
+        return(-1);
+    }
+
+    current.device = info.st_dev;
+    current.inode = info.st_ino;
+    current.seconds = info.st_mtim.tv_sec;
+    current.nanoseconds = info.st_mtim.tv_nsec;
+
+    /*
+     * Pick up where we left off if the file is the same one and has only
+     * grown since.  Same size and time means there's nothing new at all;
+     * otherwise the bytes before the old end have to match, which catches a
+     * file that was rewritten rather than added to.
+     */
+    if( load_cache(cachePath, realPath, &cached, parser) == 0 &&
+            cached.device == current.device &&
+            cached.inode == current.inode &&
+            cached.size <= (long long)info.st_size &&
+            ( (cached.size == (long long)info.st_size &&
+               cached.seconds == current.seconds &&
+               cached.nanoseconds == current.nanoseconds) ||
+              (tail_hash(fd, cached.size, &hash) == 0 &&
+               hash == cached.tailHash) ) )
+    {
+        offset = cached.size;
+    }
+    else
+    {
+        /*  Truncated, replaced or never seen:  start from scratch */
+        ttab_parser_free(parser);
+        parser = ttab_parser_new();
+        if( parser == NULL )
+        {
+            close(fd);
+            return(-1);
+        }
+    }
+
+    block = malloc(CACHE_BLOCK_SIZE);
+    if( block == NULL )
+        status = -1;
+
+    /*  Whatever's been added since gets fed through the parser */
+    while( status == 0 )
+    {
+        bytesRead = pread(fd, block, CACHE_BLOCK_SIZE, offset);
+        if( bytesRead < 0 && errno == EINTR )
+            continue;
+        if( bytesRead < 0 )
+            status = -1;
+        if( bytesRead <= 0 )
+            break;
+
+        status = ttab_parser_feed(parser, block, bytesRead);
+        offset += bytesRead;
+    }
+
+    if( status == 0 )
+    {
+        /*  The cache keeps the unfinished line; the total we report doesn't */
+        current.size = offset;
+        if( tail_hash(fd, offset, &current.tailHash) == 0 )
+            save_cache(cachePath, realPath, &current, parser);
+
+        ttab_parser_finish(parser);
+        *total = ttab_parser_total(parser);
+    }
+
+    free(block);
+    ttab_parser_free(parser);
+    close(fd);
+
+    return(status);
+}
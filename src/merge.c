@@ -0,0 +1,206 @@
+/*******************************************************************************
+ * merge.c
+ *
+ *      Reading entries back out of saved ttab logs, and merging several logs
+ *      (one per terminal, say) into a single chronological one.
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "ttab_internal.h"
+
+
+/*  An open log being merged, along with the entry currently at its head */
+struct log_stream {
+    FILE *fp;
+    int index;                  //  Position in the input list (tiebreaker)
+    struct ttab_log_entry entry;
+};
+
+
+/*
+ * Reads the next entry out of a ttab log.  Header, blank and 'Total:' lines
+ * are skipped; an entry ends at its 'Total:' line (or at the end of the file).
+ * Numbers are picked out the same way the parser does it:  a tab followed by
+ * a plus or minus sign.  Returns 1 if an entry was read, 0 at end of file.
+ *
+ * If 'position' isn't NULL, it's taken to be the byte offset fp is sitting
+ * at; it gets moved along past whatever is read, and the offset the entry
+ * started at is kept in entry->offset.
+ */
+int ttab_read_log_entry(FILE *fp, off_t *position,
+        struct ttab_log_entry *entry)
+{
+    char buffer[ TTAB_MAX_STRING_LEN ];
+    char *tab = NULL;
+    off_t lineStart = 0;
+
+    entry->numLines = 0;
+    entry->number = 0;
+    entry->offset = 0;
+
+    while( fgets(buffer, sizeof(buffer), fp) != NULL )
+    {
+        if( position != NULL )
+        {
+            lineStart = *position;
+            *position += strlen(buffer);
+        }
+
+        /*  Entry lines always start with the date, followed by a tab */
+        tab = strchr(buffer, '\t');
+        if( tab == NULL || !isdigit( (unsigned char)buffer[0] ) ||
+                tab - buffer >= TTAB_DATE_STRING_LEN )
+            continue;
+
+        /*  The running total closes out the entry */
+        if( strncmp(tab + 1, "Total:", 6) == 0 )
+        {
+            if( entry->numLines > 0 )
+                return(1);
+            continue;
+        }
+
+        if( entry->numLines == 0 )
+        {
+            entry->offset = lineStart;
+            memcpy(entry->date, buffer, tab - buffer);
+            entry->date[ tab - buffer ] = '\0';
+        }
+
+        if( entry->numLines < TTAB_ENTRY_MAX_LINES )
+        {
+            strcpy(entry->lines[ entry->numLines ], buffer);
+            ++(entry->numLines);
+        }
+
+        if( tab[1] == '+' || tab[1] == '-' )
+            entry->number += strtod(tab + 1, NULL);
+    }
+
+    return( entry->numLines > 0 );
+}
+
+
+/*
+ * Heap ordering:  earliest date first, and for entries made in the same
+ * second, whichever log came first in the input list
+ */
+static int stream_before(struct log_stream *a, struct log_stream *b)
+{
+    int cmp = strcmp(a->entry.date, b->entry.date);
+    if( cmp == 0 )
+        return( a->index < b->index );
+    return( cmp < 0 );
+}
+
+
+/*  Moves the stream at position 'pos' down the heap until it's in order */
+static void sift_down(struct log_stream **heap, int size, int pos)
+{
+    struct log_stream *temp = NULL;
+    int child = 0;
+
+    while( (child = pos * 2 + 1) < size )
+    {
+        if( child + 1 < size && stream_before(heap[child + 1], heap[child]) )
+            ++child;
+
+        if( !stream_before(heap[child], heap[pos]) )
+            break;
+
+        temp = heap[pos];
+        heap[pos] = heap[child];
+        heap[child] = temp;
+        pos = child;
+    }
+}
+
+
+/*
+ * Pulls the next entry out of a stream.  Returns 1 if there was one, 0 at the
+ * end of the log and -1 if reading it failed (errno says why).
+ */
+static int refill(struct log_stream *stream)
+{
+    if( ttab_read_log_entry(stream->fp, NULL, &stream->entry) )
+        return(1);
+
+    return( ferror(stream->fp) ? -1 : 0 );
+}
+
+
+int ttab_merge_logs(FILE **inputs, int numInputs, FILE *out)
+{
+    struct log_stream *streams = NULL;
+    struct log_stream **heap = NULL;
+    struct log_stream *top = NULL;
+    int heapSize = 0;
+    int status = 0;
+    int found = 0;
+    double total = 0;
+
+    streams = malloc( sizeof(struct log_stream) * numInputs );
+    heap = malloc( sizeof(struct log_stream *) * numInputs );
+    if( streams == NULL || heap == NULL )
+    {
+        free(streams);
+        free(heap);
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    /*  Prime the heap with the first entry of each log */
+    for( int i = 0; i < numInputs; ++i )
+    {
+        streams[i].fp = inputs[i];
+        streams[i].index = i;
+
+        found = refill(&streams[i]);
+        if( found < 0 )
+            status = -1;
+        else if( found > 0 )
+            heap[heapSize++] = &streams[i];
+    }
+
+    for( int i = heapSize / 2 - 1; i >= 0; --i )
+        sift_down(heap, heapSize, i);
+
+    /*  Same layout ttab_session_write_log uses */
+    ttab_write_log_header(out);
+    fprintf(out, "\n");
+
+    /*  A read or write error anywhere stops the merge short */
+    while( status == 0 && heapSize > 0 )
+    {
+        /*  Write out the earliest entry with its new running total */
+        top = heap[0];
+        total += top->entry.number;
+        for( int i = 0; i < top->entry.numLines; ++i )
+            fputs(top->entry.lines[i], out);
+        fprintf(out, "%s\tTotal:  %g\n\n", top->entry.date, total);
+        if( ferror(out) )
+        {
+            status = -1;
+            break;
+        }
+
+        /*  Refill from the same log, or drop it if it's run dry */
+        found = refill(top);
+        if( found < 0 )
+            status = -1;
+        else if( found == 0 )
+            heap[0] = heap[--heapSize];
+        sift_down(heap, heapSize, 0);
+    }
+
+    if( status == 0 && (fflush(out) != 0 || ferror(out)) )
+        status = -1;
+
+    free(streams);
+    free(heap);
+
+    return(status);
+}
@@ -0,0 +1,727 @@
+/*******************************************************************************
+ * parse.c
+ *
+ *      The summing engine:  turns plain lists of numbers or saved ttab logs
+ *      into a total.  Input is parsed straight out of whatever chunks the
+ *      caller hands over; only a line that straddles two chunks gets copied.
+*******************************************************************************/
+#define _GNU_SOURCE     //  For F_SETPIPE_SZ
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ttab_internal.h"
+
+/*
+ * Once an unfinished plain-format line gets this long, the numbers we already
+ * have in full are summed rather than carried, so that something like
+ * 'echo $(seq 1000000) | ttab -' doesn't need the whole line in memory
+ */
+#define CARRY_FLUSH_LEN 4096
+
+#define READ_BLOCK_SIZE 65536
+
+/*
+ * When reading from a pipe, we ask the kernel for a pipe buffer this big (the
+ * default unprivileged limit on Linux) and read it out in one go, so that the
+ * writer can get well ahead of us before anybody has to be woken up
+ */
+#define PIPE_BUFFER_SIZE (1024 * 1024)
+
+/*  Largest power of ten a double holds exactly, and largest exact integer */
+#define MAX_EXACT_POW10 22
+#define MAX_EXACT_INT ( (uint64_t)1 << 53 )
+
+static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+struct ttab_parser {
+    int format;             //  TTAB_FORMAT_PLAIN or TTAB_FORMAT_LOG
+    double total;           //  Our total
+
+    char *carry;            //  Unfinished line left over from the last chunk
+    size_t carryLen;
+    size_t carrySize;
+
+    char midLine;           //  Part of the current line was already summed
+    char inComment;         //  ...and it had a '#' in it
+
+    ttab_sink sink;         //  Optional; sees every number as it's summed
+    void *sinkData;
+
+    const struct ttab_transform *transform;     //  Optional; see transform.c
+    double batch[ TTAB_TRANSFORM_BATCH ];       //  Numbers waiting on it
+    size_t batchLen;
+};
+
+
+struct ttab_parser* ttab_parser_new(void)
+{
+    struct ttab_parser *parser = NULL;
+
+    parser = malloc( sizeof(struct ttab_parser) );
+    if( parser == NULL )
+        return(NULL);
+
+    parser->format = TTAB_FORMAT_PLAIN;
+    parser->total = 0;
+    parser->carry = NULL;
+    parser->carryLen = 0;
+    parser->carrySize = 0;
+    parser->midLine = 0;
+    parser->inComment = 0;
+    parser->sink = NULL;
+    parser->sinkData = NULL;
+    parser->transform = NULL;
+    parser->batchLen = 0;
+
+    return(parser);
+}
+
+
+void ttab_parser_free(struct ttab_parser *parser)
+{
+    if( parser == NULL )
+        return;
+
+    free(parser->carry);
+    free(parser);
+}
+
+
+double ttab_parser_total(const struct ttab_parser *parser)
+{
+    return( parser->total );
+}
+
+
+int ttab_parser_format(const struct ttab_parser *parser)
+{
+    return( parser->format );
+}
+
+
+void ttab_parser_set_sink(struct ttab_parser *parser, ttab_sink sink,
+        void *data)
+{
+    parser->sink = sink;
+    parser->sinkData = data;
+}
+
+
+/*  Every number that makes it past the transform (if any) ends up here */
+static void accumulate(struct ttab_parser *parser, double value)
+{
+    parser->total += value;     //  ADD 'ER UP BABY
+
+    if( parser->sink != NULL )
+        parser->sink(parser->sinkData, value);
+}
+
+
+/*  Runs the numbers held back so far through the transform and sums them */
+static void flush_batch(struct ttab_parser *parser)
+{
+    size_t count = 0;
+
+    if( parser->batchLen == 0 )
+        return;
+
+    count = ttab_transform_apply(parser->transform, parser->batch,
+            parser->batchLen);
+    for( size_t i = 0; i < count; ++i )
+        accumulate(parser, parser->batch[i]);
+
+    parser->batchLen = 0;
+}
+
+
+void ttab_parser_set_transform(struct ttab_parser *parser,
+        const struct ttab_transform *transform)
+{
+    flush_batch(parser);
+    parser->transform = transform;
+}
+
+
+/*
+ * Every number the parser finds ends up here.  With a transform set, numbers
+ * are held back and handed to it a batch at a time.
+ */
+static void add_value(struct ttab_parser *parser, double value)
+{
+    if( parser->transform == NULL )
+    {
+        accumulate(parser, value);
+        return;
+    }
+
+    parser->batch[ parser->batchLen++ ] = value;
+    if( parser->batchLen == TTAB_TRANSFORM_BATCH )
+        flush_batch(parser);
+}
+
+
+/*
+ * Returns 1 if the line (comments already stripped) is one of the markers
+ * that only show up at the top of a ttab log
+ */
+static int is_log_marker(const char *str, size_t len)
+{
+    /*  Ignore trailing whitespace, including any carriage return */
+    while( len > 0 && isspace( (unsigned char)str[len - 1] ) )
+        --len;
+
+    if( len == strlen(TTAB_LOG_SEPARATOR) &&
+            memcmp(str, TTAB_LOG_SEPARATOR, len) == 0 )
+        return(1);
+
+    if( len == 8 && memcmp(str, "TTAB LOG", 8) == 0 )
+        return(1);
+
+    return(0);
+}
+
+
+/*
+ * Reads the number at the front of the string, same as strtod would.  Plain
+ * decimals (no exponent, 19 digits or less) are handled here without the
+ * locale and rounding machinery strtod drags in; as long as both the digits
+ * and the power of ten fit exactly into a double, a single division gives the
+ * correctly rounded result.  Everything else goes to strtod.
+ */
+static double parse_number(const char *str)
+{
+    const char *ch = str;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int fraction = 0;
+    char negative = 0;
+    double value = 0;
+
+    if( *ch == '+' || *ch == '-' )
+        negative = ( *ch++ == '-' );
+
+    while( *ch >= '0' && *ch <= '9' && digits < 19 )
+    {
+        mantissa = mantissa * 10 + (*ch++ - '0');
+        ++digits;
+    }
+
+    if( *ch == '.' )
+    {
+        ++ch;
+        while( *ch >= '0' && *ch <= '9' && digits < 19 )
+        {
+            mantissa = mantissa * 10 + (*ch++ - '0');
+            ++digits;
+            ++fraction;
+        }
+    }
+
+    /*  Exponents, hex, inf, nan, overlong numbers:  let strtod sort it out */
+    if( digits == 0 || (*ch >= '0' && *ch <= '9') || *ch == '.' ||
+            *ch == 'e' || *ch == 'E' || *ch == 'x' || *ch == 'X' ||
+            mantissa > MAX_EXACT_INT || fraction > MAX_EXACT_POW10 )
+        return( strtod(str, NULL) );
+
+    value = (double)mantissa / powersOfTen[ fraction ];
+    return( negative ? -value : value );
+}
+
+
+/*
+ * Sums every whitespace-separated number in the span.  The character just
+ * past the span must not be able to continue a number (a newline, a '#', a
+ * space or the terminating null all qualify), since we read numbers up to it.
+ */
+static void sum_tokens(struct ttab_parser *parser, const char *str, size_t len)
+{
+    size_t i = 0;
+
+    while( i < len )
+    {
+        /*  Skip over the whitespace, then grab the number */
+        while( i < len && isspace( (unsigned char)str[i] ) )
+            ++i;
+
+        if( i < len )
+            add_value(parser, parse_number(&str[i]));
+
+        while( i < len && !isspace( (unsigned char)str[i] ) )
+            ++i;
+    }
+}
+
+
+/*
+ * In a ttab log, the number on a line comes right after a tab and always
+ * starts with a plus or minus sign.  Anything else ('Total:', the header and
+ * so on) gets skipped.
+ */
+static void sum_log_line(struct ttab_parser *parser, const char *str,
+        size_t len)
+{
+    const char *end = str + len;
+    const char *tab = memchr(str, '\t', len);
+
+    while( tab != NULL && tab + 1 < end )
+    {
+        if( tab[1] == '+' || tab[1] == '-' )
+        {
+            add_value(parser, parse_number(tab + 1));
+            return;
+        }
+
+        tab = memchr(tab + 1, '\t', end - (tab + 1));
+    }
+}
+
+
+/*  Handles one complete line, minus its newline */
+static void parse_line(struct ttab_parser *parser, const char *str, size_t len)
+{
+    char midLine = parser->midLine;
+    const char *hash = NULL;
+
+    parser->midLine = 0;
+    if( parser->inComment )
+    {
+        parser->inComment = 0;
+        return;
+    }
+
+    /*  Disregard anything after a '#' */
+    hash = memchr(str, '#', len);
+    if( hash != NULL )
+        len = hash - str;
+
+    /*  If we run into a ttab log, go into ttab log mode */
+    if( !midLine && is_log_marker(str, len) )
+    {
+        parser->format = TTAB_FORMAT_LOG;
+        return;
+    }
+
+    if( parser->format == TTAB_FORMAT_LOG )
+        sum_log_line(parser, str, len);
+    else
+        sum_tokens(parser, str, len);
+}
+
+
+/*  Tacks bytes onto the carried-over line, keeping it null terminated */
+static int append_carry(struct ttab_parser *parser, const char *buf,
+        size_t len)
+{
+    char *temp = NULL;
+    size_t newSize = parser->carrySize;
+
+    if( parser->carryLen + len + 1 > newSize )
+    {
+        if( newSize == 0 )
+            newSize = 256;
+        while( parser->carryLen + len + 1 > newSize )
+            newSize *= 2;
+
+        temp = realloc(parser->carry, newSize);
+        if( temp == NULL )
+            return(-1);
+
+        parser->carry = temp;
+        parser->carrySize = newSize;
+    }
+
+    memcpy(parser->carry + parser->carryLen, buf, len);
+    parser->carryLen += len;
+    parser->carry[ parser->carryLen ] = '\0';
+
+    return(0);
+}
+
+
+/*
+ * Sums the numbers at the front of a long, unfinished plain-format line and
+ * keeps only the last (possibly partial) one in the carry
+ */
+static void flush_carry(struct ttab_parser *parser)
+{
+    size_t keep = parser->carryLen;
+    const char *hash = NULL;
+
+    if( parser->inComment )
+    {
+        parser->carryLen = 0;
+        return;
+    }
+
+    hash = memchr(parser->carry, '#', parser->carryLen);
+    if( hash != NULL )
+    {
+        sum_tokens(parser, parser->carry, hash - parser->carry);
+        parser->inComment = 1;
+        parser->midLine = 1;
+        parser->carryLen = 0;
+        return;
+    }
+
+    while( keep > 0 && !isspace( (unsigned char)parser->carry[keep - 1] ) )
+        --keep;
+    if( keep == 0 )
+        return;     //  One enormous token; nothing we can do but wait
+
+    sum_tokens(parser, parser->carry, keep);
+    parser->midLine = 1;
+
+    memmove(parser->carry, parser->carry + keep, parser->carryLen - keep + 1);
+    parser->carryLen -= keep;
+}
+
+
+static int feed_lines(struct ttab_parser *parser, const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    const char *newline = NULL;
+
+    /*  Finish off the line left over from last time, if there is one */
+    if( parser->carryLen > 0 || parser->midLine )
+    {
+        newline = memchr(buf, '\n', len);
+        if( newline == NULL )
+        {
+            if( append_carry(parser, buf, len) != 0 )
+                return(-1);
+
+            if( parser->format == TTAB_FORMAT_PLAIN &&
+                    parser->carryLen > (CARRY_FLUSH_LEN) )
+                flush_carry(parser);
+
+            return(0);
+        }
+
+        if( append_carry(parser, buf, newline - buf) != 0 )
+            return(-1);
+
+        parse_line(parser, parser->carry, parser->carryLen);
+        parser->carryLen = 0;
+        buf = newline + 1;
+    }
+
+    /*  Every complete line gets parsed right where it sits */
+    while( buf < end && (newline = memchr(buf, '\n', end - buf)) != NULL )
+    {
+        parse_line(parser, buf, newline - buf);
+        buf = newline + 1;
+    }
+
+    /*  Hang on to whatever's left until the rest of it shows up */
+    if( buf < end )
+    {
+        if( append_carry(parser, buf, end - buf) != 0 )
+            return(-1);
+
+        if( parser->format == TTAB_FORMAT_PLAIN &&
+                parser->carryLen > (CARRY_FLUSH_LEN) )
+            flush_carry(parser);
+    }
+
+    return(0);
+}
+
+
+/*  The batch is only ever held within a call, so totals are always current */
+int ttab_parser_feed(struct ttab_parser *parser, const char *buf, size_t len)
+{
+    int status = feed_lines(parser, buf, len);
+
+    flush_batch(parser);
+    return(status);
+}
+
+
+void ttab_parser_finish(struct ttab_parser *parser)
+{
+    if( parser->carryLen > 0 || parser->midLine )
+    {
+        /*  parse_line needs something to point at, even if it's empty */
+        if( parser->carry != NULL )
+            parse_line(parser, parser->carry, parser->carryLen);
+        parser->carryLen = 0;
+        parser->midLine = 0;
+        parser->inComment = 0;
+    }
+
+    flush_batch(parser);
+}
+
+
+/*
+ * Writes out everything the parser would need to carry on later from where
+ * it is now (including any unfinished line), so that it can be picked back
+ * up by ttab_parser_load_state.  The total is written in hex so that it
+ * comes back bit for bit.
+ */
+int ttab_parser_save_state(const struct ttab_parser *parser, FILE *fp)
+{
+    fprintf(fp, "%d %a %d %d %zu\n", parser->format, parser->total,
+            parser->midLine, parser->inComment, parser->carryLen);
+
+    if( parser->carryLen > 0 &&
+            fwrite(parser->carry, 1, parser->carryLen, fp) != parser->carryLen )
+        return(-1);
+
+    return( fputc('\n', fp) == EOF ? -1 : 0 );
+}
+
+
+int ttab_parser_load_state(struct ttab_parser *parser, FILE *fp)
+{
+    int format = 0, midLine = 0, inComment = 0;
+    size_t carryLen = 0;
+    double total = 0;
+    char *carry = NULL;
+
+    if( fscanf(fp, "%d %la %d %d %zu", &format, &total, &midLine,
+                &inComment, &carryLen) != 5 || fgetc(fp) != '\n' )
+        return(-1);
+
+    if( carryLen > 0 )
+    {
+        carry = malloc(carryLen);
+        if( carry == NULL || fread(carry, 1, carryLen, fp) != carryLen )
+        {
+            free(carry);
+            return(-1);
+        }
+    }
+
+    parser->format = format;
+    parser->total = total;
+    parser->midLine = midLine;
+    parser->inComment = inComment;
+    parser->carryLen = 0;
+
+    if( carryLen > 0 && append_carry(parser, carry, carryLen) != 0 )
+    {
+        free(carry);
+        return(-1);
+    }
+
+    free(carry);
+    return(0);
+}
+
+
+int ttab_sum_buffer(const char *buf, size_t len, double *total)
+{
+    struct ttab_parser *parser = ttab_parser_new();
+    if( parser == NULL )
+        return(-1);
+
+    if( ttab_parser_feed(parser, buf, len) != 0 )
+    {
+        ttab_parser_free(parser);
+        return(-1);
+    }
+    ttab_parser_finish(parser);
+
+    *total = parser->total;
+    ttab_parser_free(parser);
+
+    return(0);
+}
+
+
+int ttab_sum_file(FILE *fp, double *total)
+{
+    struct ttab_parser *parser = NULL;
+    char *block = NULL;
+    size_t bytesRead = 0;
+    int status = 0;
+
+    parser = ttab_parser_new();
+    block = malloc(READ_BLOCK_SIZE);
+    if( parser == NULL || block == NULL )
+    {
+        ttab_parser_free(parser);
+        free(block);
+        return(-1);
+    }
+
+    while( status == 0 && (bytesRead = fread(block, 1, READ_BLOCK_SIZE, fp)) > 0 )
+        status = ttab_parser_feed(parser, block, bytesRead);
+
+    if( ferror(fp) )
+        status = -1;
+
+    if( status == 0 )
+    {
+        ttab_parser_finish(parser);
+        *total = parser->total;
+    }
+
+    ttab_parser_free(parser);
+    free(block);
+
+    return(status);
+}
+
+
+/*
+ * How much to read() from a descriptor at a time.  For a pipe, this is where
+ * the pipe buffer gets enlarged, and we then read a whole buffer's worth.
+ */
+size_t ttab_read_block_size(int fd)
+{
+    size_t blockSize = READ_BLOCK_SIZE;
+
+#ifdef F_SETPIPE_SZ
+    struct stat info;
+
+    if( fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode) )
+    {
+        /*  Not being allowed a bigger pipe isn't worth complaining about */
+        int pipeSize = fcntl(fd, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+        if( pipeSize < 0 )
+            pipeSize = fcntl(fd, F_GETPIPE_SZ);
+        if( pipeSize > READ_BLOCK_SIZE )
+            blockSize = pipeSize;
+    }
+#else
+    (void)fd;
+#endif
+
+    return(blockSize);
+}
+
+
+/*
+ * Sums everything that can be read from a file descriptor.  Regular files are
+ * mapped and parsed in place.  Pipes get their buffer enlarged and are read
+ * out a whole pipe buffer at a time, straight into the block the parser
+ * works from, with no stdio buffering in between.  Each number goes through
+ * 'transform' first, if it isn't NULL.
+ */
+int ttab_sum_fd_transformed(int fd, const struct ttab_transform *transform,
+        double *total)
+{
+    struct ttab_parser *parser = NULL;
+    struct stat info;
+    char *block = NULL;
+    size_t blockSize = READ_BLOCK_SIZE;
+    ssize_t bytesRead = 0;
+    int status = 0;
+
+    parser = ttab_parser_new();
+    if( parser == NULL )
+        return(-1);
+
+    ttab_parser_set_transform(parser, transform);
+
+    /*
+     * Only map a file we'd be reading from the top anyway; one that's been
+     * partly read already (say by a shell 'read' first) goes through read()
+     * from wherever it's at
+     */
+    if( fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 &&
+            lseek(fd, 0, SEEK_CUR) == 0 )
+    {
+        block = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if( block != MAP_FAILED )
+        {
+            madvise(block, info.st_size, MADV_SEQUENTIAL);
+            status = ttab_parser_feed(parser, block, info.st_size);
+            munmap(block, info.st_size);
+            lseek(fd, info.st_size, SEEK_SET);  //  As if we'd read it all
+
+            if( status == 0 )
+            {
+                ttab_parser_finish(parser);
+                *total = parser->total;
+            }
+            ttab_parser_free(parser);
+            return(status);
+        }
+    }
+
+    blockSize = ttab_read_block_size(fd);
+    block = malloc(blockSize);
+    if( block == NULL )
+    {
+        ttab_parser_free(parser);
+        return(-1);
+    }
+
+    while( status == 0 )
+    {
+        bytesRead = read(fd, block, blockSize);
+        if( bytesRead < 0 && errno == EINTR )
+            continue;
+        if( bytesRead < 0 )
+            status = -1;
+        if( bytesRead <= 0 )
+            break;
+
+        status = ttab_parser_feed(parser, block, bytesRead);
+    }
+
+    if( status == 0 )
+    {
+        ttab_parser_finish(parser);
+        *total = parser->total;
+    }
+
+    ttab_parser_free(parser);
+    free(block);
+
+    return(status);
+}
+
+
+int ttab_sum_fd(int fd, double *total)
+{
+    return( ttab_sum_fd_transformed(fd, NULL, total) );
+}
+
+
+/*
+ * Looks through the buffer for the markers at the top of a ttab log.  Lines
+ * are checked individually, so a log that was tacked onto the end of a list
+ * of plain numbers still counts.
+ */
+int ttab_detect_format(const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    const char *newline = NULL;
+    const char *hash = NULL;
+    size_t lineLen = 0;
+
+    while( buf < end )
+    {
+        newline = memchr(buf, '\n', end - buf);
+        lineLen = (newline != NULL) ? (size_t)(newline - buf) :
+            (size_t)(end - buf);
+
+        hash = memchr(buf, '#', lineLen);
+        if( hash != NULL )
+            lineLen = hash - buf;
+
+        if( is_log_marker(buf, lineLen) )
+            return(TTAB_FORMAT_LOG);
+
+        if( newline == NULL )
+            break;
+        buf = newline + 1;
+    }
+
+    return(TTAB_FORMAT_PLAIN);
+}
@@ -0,0 +1,333 @@
+/*******************************************************************************
+ * query.c
+ *
+ *      Totals over a time range of a saved ttab log.  The first query on a log
+ *      writes a sidecar index (LOG.idx) holding a checkpoint every so often:
+ *      the byte offset of an entry, its date and the running total up to it.
+ *      After that, a query only has to binary search the checkpoints and read
+ *      the log from the nearest one, however big the log gets.
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "ttab_internal.h"
+
+/*  A checkpoint goes in at the first entry past every this many bytes */
+#define CHECKPOINT_BYTES 65536
+
+#define INDEX_SUFFIX ".idx"
+#define INDEX_MAGIC "TTAB INDEX 1"
+
+/*  Sorts after every real date, for queries with no end to them */
+#define END_OF_TIME "9999-99-99  99:99:99"
+
+
+struct checkpoint {
+    off_t offset;                       //  Where the entry starts in the log
+    char date[TTAB_DATE_STRING_LEN];    //  The entry's date
+    double total;                       //  Sum of every entry before it
+};
+
+struct log_index {
+    struct checkpoint *points;
+    size_t count;
+    size_t size;
+};
+
+
+static int add_checkpoint(struct log_index *index, off_t offset,
+        const char *date, double total)
+{
+    struct checkpoint *temp = NULL;
+
+    if( index->count == index->size )
+    {
+        index->size = (index->size == 0) ? 64 : index->size * 2;
+        temp = realloc(index->points, index->size * sizeof(struct checkpoint));
+        if( temp == NULL )
+            return(-1);
+        index->points = temp;
+    }
+
+    index->points[ index->count ].offset = offset;
+    index->points[ index->count ].total = total;
+    strcpy(index->points[ index->count ].date, date);
+    ++(index->count);
+
+    return(0);
+}
+
+
+/*  Reads through the whole log once, dropping checkpoints as we go */
+static int build_index(FILE *fp, struct log_index *index)
+{
+    struct ttab_log_entry entry;
+    off_t position = 0;
+    off_t nextCheckpoint = 0;
+    double total = 0;
+
+    rewind(fp);
+    while( ttab_read_log_entry(fp, &position, &entry) )
+    {
+        if( entry.offset >= nextCheckpoint )
+        {
+            if( add_checkpoint(index, entry.offset, entry.date, total) != 0 )
+                return(-1);
+            nextCheckpoint = entry.offset + CHECKPOINT_BYTES;
+        }
+
+        total += entry.number;
+    }
+
+    return(0);
+}
+
+
+/*
+ * Loads the index, as long as it was built from the log as it is now (same
+ * size and modification time).  Returns 0 if it could be used, -1 if not.
+ */
+static int load_index(const char *indexPath, const struct stat *info,
+        struct log_index *index)
+{
+    FILE *fp = NULL;
+    char magic[ sizeof(INDEX_MAGIC) ];
+    long long size = 0, offset = 0;
+    long long seconds = 0, nanoseconds = 0;
+    char date[ TTAB_DATE_STRING_LEN ];
+    double total = 0;
+    int status = 0;
+
+    fp = fopen(indexPath, "r");
+    if( fp == NULL )
+        return(-1);
+
+    if( fscanf(fp, "%12[^\n] %lld %lld %lld", magic, &size, &seconds,
+                &nanoseconds) != 4 || strcmp(magic, INDEX_MAGIC) != 0 ||
+            size != (long long)info->st_size ||
+            seconds != (long long)info->st_mtim.tv_sec ||
+            nanoseconds != (long long)info->st_mtim.tv_nsec )
+    {
+        fclose(fp);
+        return(-1);
+    }
+
+    /*  Checkpoint lines are tab-separated, since dates have spaces in them */
+    while( status == 0 &&
+            fscanf(fp, " %lld\t%24[^\t]\t%lf", &offset, date, &total) == 3 )
+        status = add_checkpoint(index, offset, date, total);
+
+    fclose(fp);
+    return(status);
+}
+
+
+/*  Writes the index out; it's only a cache, so failing to is no big deal */
+static void save_index(const char *indexPath, const struct stat *info,
+        const struct log_index *index)
+{
+    char tempPath[ strlen(indexPath) + 5 ];
+    FILE *fp = NULL;
+
+    sprintf(tempPath, "%s.tmp", indexPath);
+    fp = fopen(tempPath, "w");
+    if( fp == NULL )
+        return;
+
+    fprintf(fp, "%s\n%lld %lld %lld\n", INDEX_MAGIC,
+            (long long)info->st_size, (long long)info->st_mtim.tv_sec,
+            (long long)info->st_mtim.tv_nsec);
+
+    for( size_t i = 0; i < index->count; ++i )
+    {
+        fprintf(fp, "%lld\t%s\t%.17g\n", (long long)index->points[i].offset,
+                index->points[i].date, index->points[i].total);
+    }
+
+    /*  Swap it in whole, so nobody ever sees half an index */
+    if( fclose(fp) != 0 || rename(tempPath, indexPath) != 0 )
+        remove(tempPath);
+}
+
+
+/*
+ * Turns a time from the command line into a date string we can compare
+ * against the ones in the log.  Accepted forms are 'YYYY-MM-DD HH:MM[:SS]',
+ * 'YYYY-MM-DD' and 'HH:MM[:SS]' (the last taken to be on 'day', the date the
+ * log starts on).  Whatever is left off gets filled in with the earliest
+ * possible value, or with the latest one if 'upper' is set, so '--to 14:00'
+ * runs through 14:00:59.  Returns 0, or -1 if the time makes no sense.
+ */
+static int parse_time(const char *text, const char *day, int upper,
+        char *key)
+{
+    int year = 0, month = 0, dayOfMonth = 0;
+    int hour = -1, minute = -1, second = -1;
+    int used = 0;
+    int fields = 0;
+    const char *rest = text;
+
+    /*  A date, possibly followed by a time */
+    if( sscanf(rest, "%4d-%2d-%2d%n", &year, &month, &dayOfMonth, &used) == 3 )
+    {
+        rest += used;
+        while( *rest == ' ' || *rest == 'T' )
+            ++rest;
+    }
+    else if( sscanf(day, "%4d-%2d-%2d", &year, &month, &dayOfMonth) != 3 )
+        return(-1);
+    else if( strchr(text, ':') == NULL )
+        return(-1);
+
+    if( *rest != '\0' )
+    {
+        used = 0;
+        fields = sscanf(rest, "%2d:%2d%n:%2d%n", &hour, &minute, &used,
+                &second, &used);
+        if( fields < 2 || rest[used] != '\0' )
+            return(-1);
+    }
+
+    if( month < 1 || month > 12 || dayOfMonth < 1 || dayOfMonth > 31 ||
+            hour > 23 || minute > 59 || second > 59 )
+        return(-1);
+
+    if( hour < 0 )
+        hour = upper ? 23 : 0;
+    if( minute < 0 )
+        minute = upper ? 59 : 0;
+    if( second < 0 )
+        second = upper ? 59 : 0;
+
+    snprintf(key, TTAB_DATE_STRING_LEN, "%04d-%02d-%02d  %02d:%02d:%02d",
+            year, month, dayOfMonth, hour, minute, second);
+
+    return(0);
+}
+
+
+/*
+ * Sum of every entry dated before 'key' (or at it too, if 'inclusive' is
+ * set).  Starts from the last checkpoint that qualifies and reads forward
+ * until the entries run past the key, so at most one checkpoint's worth of
+ * the log gets read.  Assumes the log is in chronological order, which
+ * anything saved or merged by ttab is.
+ */
+static double prefix_total(FILE *fp, const struct log_index *index,
+        const char *key, int inclusive)
+{
+    struct ttab_log_entry entry;
+    const struct checkpoint *start = NULL;
+    size_t low = 0, high = index->count;
+    size_t middle = 0;
+    int cmp = 0;
+    off_t position = 0;
+    double total = 0;
+
+    /*  Find the first checkpoint past the key; the one before it is ours */
+    while( low < high )
+    {
+        middle = low + (high - low) / 2;
+        cmp = strcmp(index->points[middle].date, key);
+        if( cmp < 0 || (inclusive && cmp == 0) )
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if( low == 0 )
+        return(0);
+
+    start = &index->points[ low - 1 ];
+    position = start->offset;
+    total = start->total;
+    if( fseeko(fp, position, SEEK_SET) != 0 )
+        return(total);
+
+    while( ttab_read_log_entry(fp, &position, &entry) )
+    {
+        cmp = strcmp(entry.date, key);
+        if( cmp > 0 || (!inclusive && cmp == 0) )
+            break;
+
+        total += entry.number;
+    }
+
+    return(total);
+}
+
+
+int ttab_range_total(const char *logPath, const char *from, const char *to,
+        double *total)
+{
+    struct log_index index = { NULL, 0, 0 };
+    struct stat info;
+    char indexPath[ strlen(logPath) + sizeof(INDEX_SUFFIX) ];
+    char fromKey[ TTAB_DATE_STRING_LEN ];
+    char toKey[ TTAB_DATE_STRING_LEN ];
+    const char *firstDay = "";
+    FILE *fp = NULL;
+    int status = 0;
+
+    fp = fopen(logPath, "r");
+    if( fp == NULL )
+        return(-1);
+
+    if( fstat(fileno(fp), &info) != 0 )
+    {
+        fclose(fp);
+        return(-1);
+    }
+
+    /*  Use the index if it's still good, otherwise (re)build it */
+    sprintf(indexPath, "%s%s", logPath, INDEX_SUFFIX);
+    if( load_index(indexPath, &info, &index) != 0 )
+    {
+        index.count = 0;
+        status = build_index(fp, &index);
+        if( status == 0 )
+            save_index(indexPath, &info, &index);
+        else
+            errno = ENOMEM;
+    }
+
+    if( status == 0 && index.count > 0 )
+        firstDay = index.points[0].date;
+
+    /*  An empty log totals 0 over any range, but the times still get checked */
+    if( status == 0 && index.count == 0 )
+        firstDay = "1970-01-01";
+
+    if( status == 0 )
+    {
+        if( (from != NULL && parse_time(from, firstDay, 0, fromKey) != 0) ||
+                (to != NULL && parse_time(to, firstDay, 1, toKey) != 0) )
+        {
+            errno = EINVAL;
+            status = -1;
+        }
+    }
+
+    if( status == 0 )
+    {
+        if( to == NULL )
+            strcpy(toKey, END_OF_TIME);
+
+        /*  A range that ends before it starts has nothing in it */
+        if( from != NULL && strcmp(fromKey, toKey) > 0 )
+            *total = 0;
+        else
+        {
+            *total = prefix_total(fp, &index, toKey, 1);
+            if( from != NULL )
+                *total -= prefix_total(fp, &index, fromKey, 0);
+        }
+    }
+
+    free(index.points);
+    fclose(fp);
+
+    return(status);
+}
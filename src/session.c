@@ -0,0 +1,432 @@
+/*******************************************************************************
+ * session.c
+ *
+ *      The adding machine itself:  a running total, the history of operations
+ *      that produced it (with limited 'undo' functionality) and the code that
+ *      writes that history out as a ttab log.
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "ttab_internal.h"
+
+#define LOG_BUFFER_SIZE (64 * 1024)
+
+/*  More than the longest entry could ever take to print */
+#define LOG_ENTRY_MAX 512
+
+
+struct ttab_session {
+    double total;                   //  Our total
+    struct ttab_action *undo;       //  Oldest node (the list head)
+    struct ttab_action *history;    //  Newest node
+};
+
+
+static struct ttab_action* create_node(void)
+{
+    struct ttab_action *temp = NULL;
+
+    temp = malloc( sizeof(struct ttab_action) );
+    if( temp == NULL )
+        return(NULL);
+
+    /*  Initialize everything to 0 or NULL */
+    temp->number = 0;
+    temp->runningTotal = 0;
+    memset(temp->date, '\0', TTAB_DATE_STRING_LEN);
+    temp->commentCode = 0;
+
+    temp->next = NULL;
+    temp->prev = NULL;
+
+    return(temp);
+}
+
+
+void ttab_date_string(char *buf, size_t size, int quickSaving)
+{
+    /*  Generate time, and put it into a struct we can use */
+    time_t rawTime;
+    struct tm theTime;
+
+    time(&rawTime);
+    localtime_r(&rawTime, &theTime);
+
+    /*  Fill our date string using snprintf */
+    if( quickSaving == 1 )
+    {
+        snprintf(buf, size, "%04d-%02d-%02d_%02d-%02d-%02d",
+                theTime.tm_year+1900, theTime.tm_mon+1, theTime.tm_mday,
+                theTime.tm_hour, theTime.tm_min, theTime.tm_sec);
+    }
+    else
+    {
+        snprintf(buf, size, "%04d-%02d-%02d  %02d:%02d:%02d",
+                theTime.tm_year+1900, theTime.tm_mon+1, theTime.tm_mday,
+                theTime.tm_hour, theTime.tm_min, theTime.tm_sec);
+    }
+}
+
+
+struct ttab_session* ttab_session_new(void)
+{
+    struct ttab_session *session = NULL;
+
+    session = malloc( sizeof(struct ttab_session) );
+    if( session == NULL )
+        return(NULL);
+
+    /*  The list starts out with a single, empty node */
+    session->total = 0;
+    session->undo = create_node();
+    session->history = session->undo;
+    if( session->undo == NULL )
+    {
+        free(session);
+        return(NULL);
+    }
+
+    return(session);
+}
+
+
+/*  Free allocated memory */
+void ttab_session_free(struct ttab_session *session)
+{
+    struct ttab_action *temp = NULL;
+
+    if( session == NULL )
+        return;
+
+    /*
+     * Here we step back through the history, node by node, until we get to the
+     * original, freeing each one as we go
+     */
+    while( session->history != NULL )
+    {
+        temp = session->history;
+        session->history = temp->prev;
+        free(temp);
+    }
+
+    free(session);
+}
+
+
+double ttab_session_total(const struct ttab_session *session)
+{
+    return( session->total );
+}
+
+
+const struct ttab_action* ttab_session_last(const struct ttab_session *session)
+{
+    return( session->history );
+}
+
+
+static int add_to_undo(struct ttab_session *session, double number, char cc)
+{
+    /*  Create our history node */
+    struct ttab_action *temp = create_node();
+    if( temp == NULL )
+        return(-1);
+
+    temp->number = number;                  //  The number added
+    temp->runningTotal = session->total;    //  Total after operation
+
+    /*  Getting our date / time */
+    ttab_date_string(temp->date, TTAB_DATE_STRING_LEN, 0);
+
+    /*  Comment code, see struct definition for codes */
+    temp->commentCode = cc;
+
+    /*  Swap our nodes around */
+    temp->prev = session->history;
+    session->history->next = temp;
+    session->history = temp;
+
+    return(0);
+}
+
+
+int ttab_session_add(struct ttab_session *session, double number, char mode)
+{
+    switch( mode )
+    {
+        /*
+         * EXPLICIT SUBTRACTION
+         *  Normally, a number can just be added to the total; when the minus
+         *  sign is to the right of the number, though, we have to do it
+         *  manually
+         */
+        case '-':
+            session->total -= number;
+            return( add_to_undo(session, number, 's') );
+        default:
+            session->total += number;
+            if( number < 0 )
+                return( add_to_undo(session, number, 's') );
+            else if( number > 0 )
+                return( add_to_undo(session, number, 'a') );
+            break;
+    }
+
+    return(0);
+}
+
+
+int ttab_session_clear(struct ttab_session *session)
+{
+    if( add_to_undo(session, session->total * -1, 'R') != 0 )
+        return(-1);
+
+    session->total = 0;
+    return(0);
+}
+
+
+/*
+ * Reverses the most recent operation, handing back the number it had added
+ * through 'undone'.  Returns 1 if something was undone, 0 if there was
+ * nothing left to undo.
+ */
+int ttab_session_undo(struct ttab_session *session, double *undone)
+{
+    struct ttab_action *last = session->history;
+
+    /*  Check to make sure we have a previous node to fall back to */
+    if( last->prev == NULL )
+        return(0);
+
+    /*  Reverse previous arithmetic */
+    session->total -= last->number;
+    if( undone != NULL )
+        *undone = last->number;
+
+    session->history = last->prev;  //  Assign current history to previous node
+    session->history->next = NULL;  //  Null out the pointer
+    free(last);                     //  Free memory allocated to node
+
+    return(1);
+}
+
+
+/*
+ * Log output goes through one big buffer that's handed to the kernel in a few
+ * large writes, rather than a handful of stdio calls per entry; on a long
+ * session that's the difference between instant and seconds of scrolling.
+ */
+struct log_writer {
+    char *data;
+    size_t used;
+    int fd;
+    int status;             //  -1 once a write has failed
+    const char *header;     //  Goes out ahead of the first chunk, if not NULL
+    size_t headerLen;
+};
+
+
+/*  Writes out everything in 'iov', coping with short writes and signals */
+static int write_all(int fd, struct iovec *iov, int count)
+{
+    ssize_t written = 0;
+
+    while( count > 0 )
+    {
+        written = writev(fd, iov, count);
+        if( written < 0 && errno == EINTR )
+            continue;
+        if( written < 0 )
+            return(-1);
+
+        /*  Skip past whatever made it out */
+        while( count > 0 && (size_t)written >= iov->iov_len )
+        {
+            written -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+
+        if( count > 0 )
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return(0);
+}
+
+
+static void flush_writer(struct log_writer *writer)
+{
+    struct iovec iov[2];
+    int count = 0;
+
+    if( writer->header != NULL )
+    {
+        iov[count].iov_base = (void *)writer->header;
+        iov[count].iov_len = writer->headerLen;
+        ++count;
+        writer->header = NULL;
+    }
+
+    if( writer->used > 0 )
+    {
+        iov[count].iov_base = writer->data;
+        iov[count].iov_len = writer->used;
+        ++count;
+    }
+
+    if( writer->status == 0 && write_all(writer->fd, iov, count) != 0 )
+        writer->status = -1;
+
+    writer->used = 0;
+}
+
+
+/*  Formats one history entry onto the end of the buffer */
+static void render_action(struct log_writer *writer,
+        const struct ttab_action *action)
+{
+    char *out = NULL;
+    size_t room = 0;
+    int len = 0;
+
+    if( LOG_BUFFER_SIZE - writer->used < LOG_ENTRY_MAX )
+        flush_writer(writer);
+
+    out = writer->data + writer->used;
+    room = LOG_BUFFER_SIZE - writer->used;
+
+    switch( action->commentCode )
+    {
+        case 'a':
+            len = snprintf(out, room, "%s\t+%g\n", action->date,
+                    action->number);
+            break;
+        case 's':
+            len = snprintf(out, room, "%s\t%g\n", action->date,
+                    action->number);
+            break;
+        case 'u':
+            len = snprintf(out, room, "%s\tUNDO\n%s\t%g\n", action->date,
+                    action->date, action->number);
+            break;
+        case 'R':
+            len = snprintf(out, room, "%s\tREGISTER CLEARED\n%s\t%g\n",
+                    action->date, action->date, action->number);
+            break;
+        default:
+            len = snprintf(out, room, "%sI DON'T KNOW WHAT I'M DOING\n",
+                    action->date);
+            break;
+    }
+
+    len += snprintf(out + len, room - len, "%s\tTotal:  %g\n\n", action->date,
+            action->runningTotal);
+    writer->used += len;
+}
+
+
+/*
+ * The oldest of the last 'last' entries in the history (or the very first
+ * node, if 'last' is 0 or there aren't that many).  Only walks back as far
+ * as it needs to.
+ */
+static const struct ttab_action* first_shown(const struct ttab_session *session,
+        size_t last)
+{
+    const struct ttab_action *temp = session->history;
+
+    if( last == 0 )
+        return( session->undo );
+
+    for( size_t count = 1; count < last && temp->prev != NULL; ++count )
+        temp = temp->prev;
+
+    return(temp);
+}
+
+
+/*  Writes out the history from 'temp' on, with the header first if given */
+static int render_log(const struct ttab_action *temp, const char *header,
+        int fd)
+{
+    char buffer[ LOG_BUFFER_SIZE ];
+    struct log_writer writer = { buffer, 0, fd, 0, header, 0 };
+
+    if( header != NULL )
+        writer.headerLen = strlen(header);
+
+    buffer[ writer.used++ ] = '\n';
+
+    while( temp != NULL && writer.status == 0 )
+    {
+        if( temp->commentCode != 0 )
+            render_action(&writer, temp);
+
+        temp = temp->next;
+    }
+
+    flush_writer(&writer);
+    return(writer.status);
+}
+
+
+int ttab_session_print_log(const struct ttab_session *session, size_t last,
+        int fd)
+{
+    return( render_log(first_shown(session, last), NULL, fd) );
+}
+
+
+size_t ttab_session_log_lines(const struct ttab_session *session, size_t last)
+{
+    const struct ttab_action *temp = first_shown(session, last);
+    size_t lines = 1;
+
+    for( ; temp != NULL; temp = temp->next )
+    {
+        if( temp->commentCode == 'u' || temp->commentCode == 'R' )
+            lines += 4;
+        else if( temp->commentCode != 0 )
+            lines += 3;
+    }
+
+    return(lines);
+}
+
+
+void ttab_format_log_header(char *buf, size_t size)
+{
+    char dateString[ TTAB_DATE_STRING_LEN ];
+    ttab_date_string(dateString, sizeof(dateString), 0);
+
+    snprintf(buf, size, "%s\nTTAB LOG\nCreated %s\n%s\n\n", TTAB_LOG_SEPARATOR,
+            dateString, TTAB_LOG_SEPARATOR);
+}
+
+
+void ttab_write_log_header(FILE *fp)
+{
+    char header[ TTAB_LOG_HEADER_LEN ];
+
+    ttab_format_log_header(header, sizeof(header));
+    fputs(header, fp);
+}
+
+
+int ttab_session_write_log(const struct ttab_session *session, int fd)
+{
+    char header[ TTAB_LOG_HEADER_LEN ];
+
+    ttab_format_log_header(header, sizeof(header));
+    return( render_log(session->undo, header, fd) );
+}
@@ -0,0 +1,515 @@
+/*******************************************************************************
+ * transform.c
+ *
+ *      Per-number transforms applied before summing:  maps ('x*1.0825') that
+ *      replace each number with the value of an expression, and filters
+ *      ('x>0') that drop the numbers the expression comes out 0 for.
+ *
+ *      Each expression is compiled once into a short stack program.  Numbers
+ *      are run through it in batches, one instruction at a time over the
+ *      whole batch, so the cost of interpreting the program is spread over a
+ *      few hundred numbers and each instruction is a tight loop.
+ *
+ *      Expressions are made of x (the number), constants, + - * /, unary
+ *      minus, comparisons (< <= > >= == !=, giving 1 or 0), && || !, abs()
+ *      and parentheses, with the usual C precedence.
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+
+#include "ttab_internal.h"
+
+/*  How deep an expression's stack is allowed to get */
+#define MAX_DEPTH 16
+
+/*  How deeply parentheses, unary operators and abs() may nest */
+#define MAX_NESTING 64
+
+
+enum opcode {
+    OP_X, OP_CONSTANT,
+    OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE,
+    OP_LESS, OP_LESS_EQUAL, OP_GREATER, OP_GREATER_EQUAL, OP_EQUAL,
+    OP_NOT_EQUAL, OP_AND, OP_OR,
+    OP_NEGATE, OP_NOT, OP_ABS
+};
+
+struct instruction {
+    enum opcode op;
+    double constant;        //  For OP_CONSTANT
+};
+
+/*  One --map or --filter */
+struct stage {
+    struct instruction *code;
+    size_t length;
+    size_t size;
+    int depth;              //  Stack depth while compiling
+    char filter;            //  Drop the number if the result is 0
+};
+
+struct ttab_transform {
+    struct stage *stages;
+    size_t numStages;
+};
+
+/*  Where the compiler is in the expression text */
+struct compiler {
+    const char *pos;
+    struct stage *stage;
+    int nesting;            //  How many levels of recursion we're in
+    int status;             //  -1 once anything has gone wrong
+};
+
+
+static void parse_or(struct compiler *compiler);
+
+
+static void emit(struct compiler *compiler, enum opcode op, double constant)
+{
+    struct stage *stage = compiler->stage;
+    struct instruction *temp = NULL;
+
+    if( compiler->status != 0 )
+        return;
+
+    if( stage->length == stage->size )
+    {
+        stage->size = (stage->size == 0) ? 16 : stage->size * 2;
+        temp = realloc(stage->code, stage->size * sizeof(struct instruction));
+        if( temp == NULL )
+        {
+            errno = ENOMEM;
+            compiler->status = -1;
+            return;
+        }
+        stage->code = temp;
+    }
+
+    stage->code[ stage->length ].op = op;
+    stage->code[ stage->length ].constant = constant;
+    ++(stage->length);
+
+    /*  Keep track of how deep the stack gets, so we can refuse too deep */
+    if( op == OP_X || op == OP_CONSTANT )
+        ++(stage->depth);
+    else if( op < OP_NEGATE )
+        --(stage->depth);
+
+    if( stage->depth > MAX_DEPTH )
+    {
+        errno = EINVAL;
+        compiler->status = -1;
+    }
+}
+
+
+static void syntax_error(struct compiler *compiler)
+{
+    if( compiler->status == 0 )
+        errno = EINVAL;
+    compiler->status = -1;
+}
+
+
+/*
+ * All of the compiler's recursion goes through parse_unary, which brackets
+ * itself with these two, so that something like 60000 '('s is refused rather
+ * than overflowing the C stack
+ */
+static int enter(struct compiler *compiler)
+{
+    if( compiler->status != 0 )
+        return(0);
+
+    if( compiler->nesting >= MAX_NESTING )
+    {
+        syntax_error(compiler);
+        return(0);
+    }
+
+    ++(compiler->nesting);
+    return(1);
+}
+
+
+static void leave(struct compiler *compiler)
+{
+    --(compiler->nesting);
+}
+
+
+/*  Skips spaces and, if the text at 'pos' starts with 'token', eats it */
+static int accept(struct compiler *compiler, const char *token)
+{
+    size_t len = strlen(token);
+
+    while( isspace( (unsigned char)*compiler->pos ) )
+        ++(compiler->pos);
+
+    if( strncmp(compiler->pos, token, len) != 0 )
+        return(0);
+
+    compiler->pos += len;
+    return(1);
+}
+
+
+/*  x, a number, abs(...) or a parenthesized expression */
+static void parse_primary(struct compiler *compiler)
+{
+    char *end = NULL;
+    double constant = 0;
+
+    if( accept(compiler, "abs") )
+    {
+        if( !accept(compiler, "(") )
+        {
+            syntax_error(compiler);
+            return;
+        }
+        parse_or(compiler);
+        if( !accept(compiler, ")") )
+            syntax_error(compiler);
+        emit(compiler, OP_ABS, 0);
+    }
+    else if( accept(compiler, "(") )
+    {
+        parse_or(compiler);
+        if( !accept(compiler, ")") )
+            syntax_error(compiler);
+    }
+    else if( accept(compiler, "x") )
+        emit(compiler, OP_X, 0);
+    else if( isdigit( (unsigned char)*compiler->pos ) || *compiler->pos == '.' )
+    {
+        constant = strtod(compiler->pos, &end);
+        if( end == compiler->pos )
+            syntax_error(compiler);
+        compiler->pos = end;
+        emit(compiler, OP_CONSTANT, constant);
+    }
+    else
+        syntax_error(compiler);
+}
+
+
+static void parse_unary(struct compiler *compiler)
+{
+    if( !enter(compiler) )
+        return;
+
+    if( accept(compiler, "-") )
+    {
+        parse_unary(compiler);
+        emit(compiler, OP_NEGATE, 0);
+    }
+    else if( accept(compiler, "!") )
+    {
+        /*  Not to be confused with != (which can't start an operand anyway) */
+        parse_unary(compiler);
+        emit(compiler, OP_NOT, 0);
+    }
+    else if( accept(compiler, "+") )
+        parse_unary(compiler);
+    else
+        parse_primary(compiler);
+
+    leave(compiler);
+}
+
+
+static void parse_product(struct compiler *compiler)
+{
+    parse_unary(compiler);
+
+    while( compiler->status == 0 )
+    {
+        if( accept(compiler, "*") )
+        {
+            parse_unary(compiler);
+            emit(compiler, OP_MULTIPLY, 0);
+        }
+        else if( accept(compiler, "/") )
+        {
+            parse_unary(compiler);
+            emit(compiler, OP_DIVIDE, 0);
+        }
+        else
+            break;
+    }
+}
+
+
+static void parse_sum(struct compiler *compiler)
+{
+    parse_product(compiler);
+
+    while( compiler->status == 0 )
+    {
+        if( accept(compiler, "+") )
+        {
+            parse_product(compiler);
+            emit(compiler, OP_ADD, 0);
+        }
+        else if( accept(compiler, "-") )
+        {
+            parse_product(compiler);
+            emit(compiler, OP_SUBTRACT, 0);
+        }
+        else
+            break;
+    }
+}
+
+
+static void parse_comparison(struct compiler *compiler)
+{
+    /*  Two-character operators have to be tried before their prefixes */
+    static const struct {
+        const char *token;
+        enum opcode op;
+    } comparisons[] = {
+        { "<=", OP_LESS_EQUAL }, { ">=", OP_GREATER_EQUAL },
+        { "==", OP_EQUAL }, { "!=", OP_NOT_EQUAL },
+        { "<", OP_LESS }, { ">", OP_GREATER }
+    };
+
+    parse_sum(compiler);
+
+    for( size_t i = 0; i < sizeof(comparisons) / sizeof(comparisons[0]); ++i )
+    {
+        if( accept(compiler, comparisons[i].token) )
+        {
+            parse_sum(compiler);
+            emit(compiler, comparisons[i].op, 0);
+            break;
+        }
+    }
+}
+
+
+static void parse_and(struct compiler *compiler)
+{
+    parse_comparison(compiler);
+
+    while( compiler->status == 0 && accept(compiler, "&&") )
+    {
+        parse_comparison(compiler);
+        emit(compiler, OP_AND, 0);
+    }
+}
+
+
+static void parse_or(struct compiler *compiler)
+{
+    parse_and(compiler);
+
+    while( compiler->status == 0 && accept(compiler, "||") )
+    {
+        parse_and(compiler);
+        emit(compiler, OP_OR, 0);
+    }
+}
+
+
+struct ttab_transform* ttab_transform_new(void)
+{
+    struct ttab_transform *transform = NULL;
+
+    transform = malloc( sizeof(struct ttab_transform) );
+    if( transform == NULL )
+        return(NULL);
+
+    transform->stages = NULL;
+    transform->numStages = 0;
+
+    return(transform);
+}
+
+
+void ttab_transform_free(struct ttab_transform *transform)
+{
+    if( transform == NULL )
+        return;
+
+    for( size_t i = 0; i < transform->numStages; ++i )
+        free(transform->stages[i].code);
+
+    free(transform->stages);
+    free(transform);
+}
+
+
+int ttab_transform_add(struct ttab_transform *transform, const char *expr,
+        int filter)
+{
+    struct stage *temp = NULL;
+    struct stage stage = { NULL, 0, 0, 0, filter != 0 };
+    struct compiler compiler = { expr, &stage, 0, 0 };
+
+    parse_or(&compiler);
+
+    /*  Anything but spaces left over means the expression didn't make sense */
+    accept(&compiler, "");
+    if( compiler.status == 0 && *compiler.pos != '\0' )
+        syntax_error(&compiler);
+
+    if( compiler.status == 0 )
+    {
+        temp = realloc(transform->stages,
+                (transform->numStages + 1) * sizeof(struct stage));
+        if( temp == NULL )
+        {
+            errno = ENOMEM;
+            compiler.status = -1;
+        }
+    }
+
+    if( compiler.status != 0 )
+    {
+        free(stage.code);
+        return(-1);
+    }
+
+    transform->stages = temp;
+    transform->stages[ transform->numStages ] = stage;
+    ++(transform->numStages);
+
+    return(0);
+}
+
+
+/*  Runs a stage's program over 'count' numbers, leaving the answers in 'out' */
+static void run_stage(const struct stage *stage, const double *values,
+        size_t count, double *out)
+{
+    double stack[ MAX_DEPTH ][ TTAB_TRANSFORM_BATCH ];
+    double *a = NULL;
+    double *b = NULL;
+    int top = -1;
+
+    for( size_t pc = 0; pc < stage->length; ++pc )
+    {
+        const struct instruction *in = &stage->code[pc];
+
+        /*  'a' is the operand under the top of the stack, 'b' the top */
+        a = stack[ (top > 0) ? top - 1 : 0 ];
+        b = stack[ (top >= 0) ? top : 0 ];
+
+        switch( in->op )
+        {
+            case OP_X:
+                memcpy(stack[ ++top ], values, count * sizeof(double));
+                continue;
+            case OP_CONSTANT:
+                a = stack[ ++top ];
+                for( size_t i = 0; i < count; ++i )
+                    a[i] = in->constant;
+                continue;
+
+            case OP_NEGATE:
+                for( size_t i = 0; i < count; ++i )
+                    b[i] = -b[i];
+                continue;
+            case OP_NOT:
+                for( size_t i = 0; i < count; ++i )
+                    b[i] = (b[i] == 0);
+                continue;
+            case OP_ABS:
+                for( size_t i = 0; i < count; ++i )
+                    b[i] = fabs(b[i]);
+                continue;
+
+            case OP_ADD:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] += b[i];
+                break;
+            case OP_SUBTRACT:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] -= b[i];
+                break;
+            case OP_MULTIPLY:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] *= b[i];
+                break;
+            case OP_DIVIDE:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] /= b[i];
+                break;
+            case OP_LESS:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] = (a[i] < b[i]);
+                break;
+            case OP_LESS_EQUAL:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] = (a[i] <= b[i]);
+                break;
+            case OP_GREATER:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] = (a[i] > b[i]);
+                break;
+            case OP_GREATER_EQUAL:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] = (a[i] >= b[i]);
+                break;
+            case OP_EQUAL:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] = (a[i] == b[i]);
+                break;
+            case OP_NOT_EQUAL:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] = (a[i] != b[i]);
+                break;
+            case OP_AND:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] = (a[i] != 0 && b[i] != 0);
+                break;
+            case OP_OR:
+                for( size_t i = 0; i < count; ++i )
+                    a[i] = (a[i] != 0 || b[i] != 0);
+                break;
+        }
+
+        --top;      //  Binary operators leave one value where there were two
+    }
+
+    memcpy(out, stack[0], count * sizeof(double));
+}
+
+
+/*
+ * Runs up to TTAB_TRANSFORM_BATCH numbers through every stage in turn,
+ * rewriting them in place.  Filtered-out numbers are squeezed out, and the
+ * count of numbers left is returned.
+ */
+size_t ttab_transform_apply(const struct ttab_transform *transform,
+        double *values, size_t count)
+{
+    double results[ TTAB_TRANSFORM_BATCH ];
+    size_t kept = 0;
+
+    for( size_t s = 0; s < transform->numStages && count > 0; ++s )
+    {
+        run_stage(&transform->stages[s], values, count, results);
+
+        if( !transform->stages[s].filter )
+        {
+            memcpy(values, results, count * sizeof(double));
+            continue;
+        }
+
+        kept = 0;
+        for( size_t i = 0; i < count; ++i )
+        {
+            if( results[i] != 0 )
+                values[ kept++ ] = values[i];
+        }
+        count = kept;
+    }
+
+    return(count);
+}
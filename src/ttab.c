@@ -1,5 +1,5 @@
 /*******************************************************************************
- * ttab.c   |   v 0.95  |   GPL v 3     |   2021-04-06
+ * ttab.c   |   v 0.96  |   GPL v 3     |   2026-10-18
  * James Hendrie        |   hendrie dot james at gmail dot com
  *
  *      ttab is a simple adding program; you use it to add or subtract one
@@ -7,19 +7,38 @@
  *      and also has a built-in history and limited 'undo' functionality.  It
  *      can also sum up numbers piped to it.  See the README or man file for
  *      more information.
+ *
+ *      This file is just the terminal front end; the adding, summing and
+ *      history all live in libttab (see ttab.h).
 *******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-
-#define TTAB_VERSION "0.95"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "ttab.h"
 
-#define DATE_STRING_LEN 25
 #define NUM_STRING_LEN 64
 #define MAX_STRING_LEN 80
 
-double total;
+/*  Most numbers (or seconds) a window can span:  128 MiB worth of slots */
+#define MAX_WINDOW_SLOTS (16 * 1024 * 1024)
+
+/*  Longest --every; time windows turn it into milliseconds for poll() */
+#define MAX_EVERY (INT_MAX / 1000)
+
+struct ttab_session *session;
+struct ttab_transform *transform;   //  --map / --filter, NULL if none given
 double entered;
 char line[ (MAX_STRING_LEN) ];
 char *saveLocation;
@@ -40,60 +59,35 @@ void print_help(void);
 void clean_up(void);
 void print_version_info(void);
 void truncate_zeroes( double total );
-void sum_log(FILE *fp);
-void sum_log_stdin(void);
-void print_log(FILE *fp);
+int sum_log(FILE *fp, const char *location);
+int sum_log_stdin(void);
+int sum_window_stdin(size_t count, unsigned int seconds, long every);
 void save_file(char *saveLocation);
+void show_log(size_t last);
+int merge_logs(char **inputs, int numInputs, const char *outputLocation);
+int range_total(const char *logLocation, const char *from, const char *to);
+int sum_binary(const char *location, int type, int byteOrder);
+int sum_incremental(const char *location, char watching);
+void add_transform(const char *expr, int filter);
+long parse_count(const char *text);
 void undo_prev(void);
 void mem_error(const char *description);
-void add_to_undo(double *current, char cc);
 void do_math(double *current);
 void clear_register(double *current);
-struct action* create_node(void);
 double* get_entered(double *current);
-char* get_date_string(char quickSaving);
 
 /****************    -------  END PROTOTYPES  ------    ***********************/
 
 
-struct action {
-    double number;              //  Number added / subtracted / whatever
-    double runningTotal;        //  Running total after operation
-
-    char date[DATE_STRING_LEN]; //  Date at which operation was performed
-
-    /*
-     * Single-character comment code.
-     *
-     * 'R' = register reset
-     * 'L' = clear log
-     * 'A' = clear all (register and total)
-     *
-     * 'w' = write file
-     * 'l' = load file
-     *
-     * 'a' = number added
-     * 's' = number subtracted
-     * 'u' = undo operation
-     *
-     * Any other character code(s) will result in no comment being added (0)
-     *
-     */
-    char commentCode;
-
-    struct action *next;    //  Our next node pointer
-    struct action *prev;    //  Our previous node pointer
-};
-
-
-/*  Create empty list pointers */
-struct action *undo;
-struct action *history;
-
-
 void print_usage(void)
 {
     printf("Usage:  ttab [OPTION]\n");
+    printf("        ttab --merge FILE [FILE ...] [-o OUTPUT]\n");
+    printf("        ttab [--from TIME] [--to TIME] FILE\n");
+    printf("        ttab --window N | --window-time SECONDS [--every K] -\n");
+    printf("        ttab --binary=TYPE [--endian=ORDER] FILE\n");
+    printf("        ttab --incremental | --watch FILE\n");
+    printf("        ttab [--map EXPR] [--filter EXPR] FILE\n");
 }
 
 void print_commands(void)
@@ -106,6 +100,7 @@ void print_commands(void)
     printf("\t\t\tprevious specified)\n");
 
     printf("\tl or *\t\tShow running log\n");
+    printf("\tl N\t\tShow only the last N entries of the log\n");
     printf("\tc\t\tClear register\n");
     printf("\tu\t\tUndo previous operation\n");
     printf("\t-\t\tPerform arithmetic opposite to previous operation once\n");
@@ -120,6 +115,23 @@ void print_options(void)
     printf("\t-h or --help:\tPrint this help text\n");
     printf("\t--version:\tPrint version and author info\n");
     printf("\t-\t\tRead from stdin\n");
+    printf("\t--merge FILES\tMerge ttab logs into one chronological log\n");
+    printf("\t-o OUTPUT\tWith --merge, write to OUTPUT instead of stdout\n");
+    printf("\t--from TIME\tOnly sum log entries from TIME onward\n");
+    printf("\t--to TIME\tOnly sum log entries up through TIME\n");
+    printf("\t--window N\tWith -, print the total of the last N numbers\n");
+    printf("\t--window-time T\tWith -, print the total of the last T seconds\n");
+    printf("\t--every K\tPrint window totals every K numbers (or, with\n");
+    printf("\t\t\t--window-time, every K seconds)\n");
+    printf("\t--binary=TYPE\tInput is raw f64, f32, i64 or i32 numbers\n");
+    printf("\t--endian=ORDER\tByte order of binary input:  little, big or\n");
+    printf("\t\t\tnative (the default)\n");
+    printf("\t--incremental\tOnly read what was added to FILE since the last\n");
+    printf("\t\t\trun\n");
+    printf("\t--watch\t\tPrint FILE's total again whenever it grows\n");
+    printf("\t--map EXPR\tSum EXPR instead of each number x (e.g. x*1.08)\n");
+    printf("\t--filter EXPR\tOnly sum the numbers x for which EXPR holds\n");
+    printf("\t\t\t(e.g. 'x>0 && x<1000')\n");
 }
 
 void print_help(void)
@@ -150,30 +162,6 @@ void mem_error(const char *description)
 }
 
 
-struct action* create_node(void)
-{
-    struct action *temp = NULL;
-
-    temp = malloc( sizeof(struct action) );
-    if( temp == NULL )
-        mem_error("function:  create_node");
-
-    /*  Initialize everything to 0 or NULL */
-    temp->number = 0;
-    temp->runningTotal = 0;
-
-    /* OMITTED (because I don't need to set them here:
-     * char date[25]
-     * char commentCode
-     */
-
-    temp->next = NULL;
-    temp->prev = NULL;
-
-    return(temp);
-}
-
-
 void print_prompt(void)
 {
     /*
@@ -181,6 +169,8 @@ void print_prompt(void)
      * from the display register.  Basically, if there are 5 chars or less, we
      * tab to the right twice.  Any more, we tab only once.
      */
+    double total = ttab_session_total(session);
+
     if( total < 10000 && total > -1000 )
         printf("[%g]:\t\t", total);
     else
@@ -228,179 +218,165 @@ void truncate_zeroes( double total )
  * This function exists so that people can just pipe numbers to the program
  * and have it add them up
  */
-void sum_log_stdin(void)
+int sum_log_stdin(void)
 {
+    double total = 0;
 
+    /*  Straight from the file descriptor; stdio would only slow us down */
+    if( ttab_sum_fd_transformed(STDIN_FILENO, transform, &total) != 0 )
+    {
+        if( errno == ENOMEM )
+            mem_error("function:  sum_log_stdin");
 
-    char *theNumber = NULL;     //  Used for strtok
-    char good[ (MAX_STRING_LEN) ];
+        fprintf(stderr, "ERROR:  Cannot read from stdin:  %s\n",
+                strerror(errno));
+        return(1);
+    }
 
-    while( fgets(line, 80, stdin) != NULL )
-    {
-        /*  Reset the 'good' number */
-        memset( good, '\0', (MAX_STRING_LEN) );
+    truncate_zeroes( total );
+    return(0);
+}
 
-        for( int i = 0, ch = line[ i ]; i < strlen( line ); ++i )
-        {
-            if( ch == '#' )
-                break;
-            good[ i ] = line[ i ];
-        }
 
-        /*  Check for ttab logs */
-        if( strcmp(good, "----------------------------------------\n") == 0 )
-        {
-            /*
-             * If it's a ttab log, send it to the standard sum_log function and
-             * treat it like a normal file.  To be completely honest, I'm a bit
-             * surprised that this actually works
-             */
-            sum_log(stdin);
-
-            exit(0);    //  Exit the program
-        }
+/*  What the parser's sink needs to keep a window up to date */
+struct window_state {
+    struct ttab_window *window;
+    time_t now;             //  When the numbers being parsed came in
+    long every;             //  Print a total every this many numbers
+    long sinceLast;         //  Numbers since we last printed one
+};
 
-        /*
-         * We'll use strtok to tokenize the string, number by number, using the
-         * space character as a delimiter
-         */
-        theNumber = strtok(good, " ");
-        while( theNumber != NULL )
-        {
-            total += atof(theNumber);       //  ADD 'ER UP BABY
-            theNumber = strtok(NULL, " ");  //  Re-run strtok, grab next number
-        }
-    }
 
-    /*  Print our total */
-    truncate_zeroes( total );
+void print_window_total(struct ttab_window *window)
+{
+    truncate_zeroes( ttab_window_total(window) );
+    fflush(stdout);
 }
 
 
-void sum_log(FILE *fp)
+void window_sink(void *data, double value)
 {
-    char ttabLogMode = 0;           //  Special mode for ttab logs
-    char *numberLocation = NULL;    //  Pointer to string containing number
-    char ch = 0;                    //  Used for ttab mode
-    counter = 0;                    //  ''
-    total = 0;                      //  Our total
+    struct window_state *state = data;
 
-    char good[ (MAX_STRING_LEN) ];
+    ttab_window_add(state->window, value, state->now);
 
-    /*  Get lines from file pointer */
-    while( fgets(line, 80, fp) != NULL )
+    if( state->every > 0 && ++(state->sinceLast) >= state->every )
     {
-        counter = 0;    //  Reset counter
+        print_window_total(state->window);
+        state->sinceLast = 0;
+    }
+}
 
-        /*  Make a copy of the line but exclude comments */
-        memset( good, '\0', (MAX_STRING_LEN) );
-        for( int i = 0, ch = line[ i ]; i < strlen( line ); ++i )
-        {
-            if( ch == '#' )
-                break;
-            good[ i ] = line[ i ];
-        }
 
-        /*  If we run into a ttab log, go into ttab log mode */
-        if( strcmp( good, "TTAB LOG\n") == 0 )
+/*
+ * For live monitoring:  sums stdin as it comes in, but only over a sliding
+ * window (the last 'count' numbers, or the last 'seconds' seconds), printing
+ * the window's total every 'every' numbers for a count window or every
+ * 'every' seconds for a time window.  Time windows keep ticking (and
+ * printing) even while nothing is coming in.
+ */
+/*
+ * Prints sliding-window totals over stdin until it runs out.  Returns 0, or
+ * 1 if reading it failed.
+ */
+int sum_window_stdin(size_t count, unsigned int seconds, long every)
+{
+    struct ttab_parser *parser = ttab_parser_new();
+    struct window_state state;
+    struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+    char block[ 65536 ];
+    ssize_t bytesRead = 0;
+    time_t nextPrint = 0;
+    int timeout = -1;
+
+    state.window = ttab_window_new(count, seconds);
+    if( parser == NULL || state.window == NULL )
+        mem_error("function:  sum_window_stdin");
+
+    state.now = time(NULL);
+    state.every = (seconds > 0) ? 0 : every;
+    state.sinceLast = 0;
+    ttab_parser_set_sink(parser, window_sink, &state);
+    ttab_parser_set_transform(parser, transform);
+
+    nextPrint = state.now + every;
+
+    while(1)
+    {
+        if( seconds > 0 )
         {
-            ttabLogMode = 1;
+            state.now = time(NULL);
+            timeout = 0;
+            if( nextPrint > state.now )
+                timeout = (nextPrint - state.now) * 1000;
         }
 
-        /*  If we're in ttab log mode */
-        if( ttabLogMode == 1 )
+        if( poll(&input, 1, timeout) > 0 )
         {
-            numberLocation = NULL;  //  Null out number location pointer
-
-            ch = good[counter];     //  Initialize ch
-
-            /*  While we're getting characters that are potentially useful */
-            while( ch != '\n' && ch != '\0' && ch != EOF )
+            bytesRead = read(STDIN_FILENO, block, sizeof(block));
+            if( bytesRead < 0 && errno == EINTR )
+                continue;
+            if( bytesRead < 0 )
             {
-                ch = good[counter];     //  Reset ch to its position in the line
-                
-                if( ch == '\t' )        //  If we find a tab character
-                {
-                    /* 
-                     * If the next character after the tab is a plus or a minus,
-                     * we've finally found our number
-                     */
-                    if( good[counter + 1] == '+' || good[counter + 1] == '-' )
-                    {
-                        /*
-                         * Here we assign the address of the position in the
-                         * string where we've found the number to numberLocation
-                         */
-                        numberLocation = &good[counter+1];
-                        break;
-                    }
-                }
-
-                ++counter;      //  Increment the counter to keep things a-movin
-            }
-
-            /*  If we found a usable number (finally), add it to total */
-            if( numberLocation != NULL )
-            {
-                total += atof(numberLocation);
+                fprintf(stderr, "ERROR:  Cannot read from stdin:  %s\n",
+                        strerror(errno));
+                ttab_parser_free(parser);
+                ttab_window_free(state.window);
+                return(1);
             }
+            if( bytesRead == 0 )
+                break;
 
-        }   /*  -------     END ttab log mode   ----- */
+            state.now = time(NULL);
+            if( ttab_parser_feed(parser, block, bytesRead) != 0 )
+                mem_error("function:  sum_window_stdin");
+        }
 
-        else    //  If we're doing a normal file / stdin
+        /*  Time windows print on the clock, whether or not anything came in */
+        if( seconds > 0 && (state.now = time(NULL)) >= nextPrint )
         {
-            /*  Add whatever's on the line to the total */
-            total += atof(good);
+            ttab_window_advance(state.window, state.now);
+            print_window_total(state.window);
+
+            nextPrint += every;
+            if( nextPrint <= state.now )
+                nextPrint = state.now + every;
         }
     }
 
-    /*  Print total to stdout */
-    truncate_zeroes( total );
-    //printf("%lf\n", total);
-}
+    ttab_parser_finish(parser);
 
+    /*  One last total, unless we just printed it */
+    if( seconds > 0 || state.sinceLast > 0 )
+    {
+        ttab_window_advance(state.window, time(NULL));
+        print_window_total(state.window);
+    }
 
-void print_log(FILE *fp)
-{
-    /*  First, check which file stream we're using */
-    FILE *fs = fp;
-    if( fs == NULL )
-        fs = stdout;
+    ttab_parser_free(parser);
+    ttab_window_free(state.window);
 
-    struct action *temp = undo;
+    return(0);
+}
 
-    fprintf(fs, "\n");
 
-    while( temp != NULL )
+int sum_log(FILE *fp, const char *location)
+{
+    double total = 0;
+
+    if( ttab_sum_fd_transformed(fileno(fp), transform, &total) != 0 )
     {
-        if( temp->commentCode != 0 )
-        {
-            fprintf(fs, "%s", temp->date);
-            switch( temp->commentCode )
-            {
-                case 'a':
-                    fprintf(fs, "\t+%g\n", temp->number);
-                    break;
-                case 's':
-                    fprintf(fs, "\t%g\n", temp->number);
-                    break;
-                case 'u':
-                    fprintf(fs, "\tUNDO\n");
-                    fprintf(fs, "%s\t%g\n", temp->date, temp->number);
-                    break;
-                case 'R':
-                    fprintf(fs, "\tREGISTER CLEARED\n");
-                    fprintf(fs, "%s\t%g\n", temp->date, temp->number);
-                    break;
-                default:
-                    fprintf(fs, "I DON'T KNOW WHAT I'M DOING\n");
-                    break;
-            }
-            fprintf(fs, "%s\tTotal:  %g\n\n", temp->date, temp->runningTotal);
-        }
+        if( errno == ENOMEM )
+            mem_error("function:  sum_log");
 
-        temp = temp->next;
+        fprintf(stderr, "ERROR:  Cannot read from %s:  %s\n", location,
+                strerror(errno));
+        return(1);
     }
+
+    /*  Print total to stdout */
+    truncate_zeroes( total );
+    return(0);
 }
 
 
@@ -433,13 +409,15 @@ void save_file(char *saveLocation)
 
     if( fp != NULL )
     {
-        //  Timestamp
-        fprintf(fp, "----------------------------------------\nTTAB LOG\n");
-        fprintf(fp,"Created %s\n", get_date_string(0) );
-        fprintf(fp, "----------------------------------------\n\n");
-
-        //  Send the file pointer to print_log
-        print_log(fp);
+        //  Timestamp, then the log itself
+        if( ttab_session_write_log(session, fileno(fp)) != 0 )
+        {
+            fprintf(stderr, "\nERROR:  Cannot write log to %s\n\n",
+                    saveLocation);
+            fclose(fp);
+            return;
+        }
+        fclose(fp);
 
         //  Tell the user what's up
         printf("\nLog written to %s\n\n", saveLocation);
@@ -447,16 +425,334 @@ void save_file(char *saveLocation)
 }
 
 
+/*
+ * Shows the log (the last 'last' entries of it, or all of it for 0).  If it
+ * won't fit on the terminal it goes through $PAGER (less, if that's not set),
+ * unless the pager can't be run, in which case it's just printed.
+ */
+void show_log(size_t last)
+{
+    struct winsize size;
+    const char *pagerCommand = getenv("PAGER");
+    FILE *pager = NULL;
+    size_t shown = last;
+    int status = 0;
+
+    fflush(stdout);
+
+    /*  Only the last screenful matters for deciding whether it fits */
+    if( isatty(STDOUT_FILENO) &&
+            ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 )
+    {
+        if( shown == 0 || shown > size.ws_row )
+            shown = size.ws_row;
+
+        if( ttab_session_log_lines(session, shown) >= size.ws_row )
+        {
+            if( pagerCommand == NULL || pagerCommand[0] == '\0' )
+                pagerCommand = "less";
+            pager = popen(pagerCommand, "w");
+        }
+    }
+
+    if( pager != NULL )
+    {
+        /*  Quitting the pager early shouldn't take us down with it */
+        signal(SIGPIPE, SIG_IGN);
+        ttab_session_print_log(session, last, fileno(pager));
+        status = pclose(pager);
+        signal(SIGPIPE, SIG_DFL);
+
+        if( status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 127 )
+            return;
+    }
+
+    ttab_session_print_log(session, last, STDOUT_FILENO);
+}
+
+
+/*
+ * Prints the total of a saved log between two times (see ttab_range_total
+ * for what they look like).  Returns 0 on success, 1 on failure.
+ */
+int range_total(const char *logLocation, const char *from, const char *to)
+{
+    double total = 0;
+
+    if( ttab_range_total(logLocation, from, to, &total) != 0 )
+    {
+        if( errno == EINVAL )
+            fprintf(stderr, "ERROR:  Invalid time (use YYYY-MM-DD HH:MM:SS, "
+                    "YYYY-MM-DD or HH:MM:SS)\n");
+        else if( errno == ENOMEM )
+            mem_error("function:  range_total");
+        else
+            fprintf(stderr, "ERROR:  Cannot open file for reading:  %s\n",
+                    logLocation);
+        return(1);
+    }
+
+    truncate_zeroes( total );
+    return(0);
+}
+
+
+/*
+ * Sums raw binary numbers from a file (or stdin, for '-').  Returns 0 on
+ * success, 1 on failure.
+ */
+int sum_binary(const char *location, int type, int byteOrder)
+{
+    double total = 0;
+    size_t leftover = 0;
+    int fd = STDIN_FILENO;
+    int status = 0;
+
+    if( strcmp(location, "-") != 0 )
+    {
+        FILE *fp = fopen(location, "r");
+        if( fp == NULL )
+        {
+            fprintf(stderr, "ERROR:  Cannot open file for reading:  %s\n",
+                    location);
+            return(1);
+        }
+
+        fd = dup( fileno(fp) );
+        fclose(fp);
+    }
+
+    status = ttab_sum_binary_fd(fd, type, byteOrder, &total, &leftover);
+    if( fd != STDIN_FILENO )
+        close(fd);
+
+    if( status != 0 )
+    {
+        if( errno == ENOMEM )
+            mem_error("function:  sum_binary");
+
+        fprintf(stderr, "ERROR:  Cannot read from %s\n", location);
+        return(1);
+    }
+
+    if( leftover > 0 )
+    {
+        fprintf(stderr, "WARNING:  Ignored %zu byte(s) at the end that don't "
+                "make up a whole number\n", leftover);
+    }
+
+    truncate_zeroes( total );
+    return(0);
+}
+
+
+/*
+ * Sums a file that only ever gets added to, reading only what's new since
+ * the last time (see ttab_sum_incremental).  With 'watching' set, it then
+ * sits and waits for the file to change, printing the new total each time it
+ * does.  The file's directory is what gets watched, so that a file that's
+ * replaced or rotated keeps being followed.  Returns 1 on failure.
+ */
+int sum_incremental(const char *location, char watching)
+{
+    double total = 0;
+    double previous = 0;
+
+    if( ttab_sum_incremental(location, NULL, &total) != 0 )
+    {
+        if( errno == ENOMEM )
+            mem_error("function:  sum_incremental");
+
+        fprintf(stderr, "ERROR:  Cannot open file for reading:  %s\n",
+                location);
+        return(1);
+    }
+
+    truncate_zeroes( total );
+    if( !watching )
+        return(0);
+
+#ifdef __linux__
+    char dirCopy[ strlen(location) + 1 ];
+    char baseCopy[ strlen(location) + 1 ];
+    char events[ 4096 ]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event = NULL;
+    const char *baseName = NULL;
+    ssize_t len = 0;
+    char changed = 0;
+    int fd = -1;
+
+    strcpy(dirCopy, location);
+    strcpy(baseCopy, location);
+    baseName = basename(baseCopy);
+
+    fd = inotify_init1(IN_CLOEXEC);
+    if( fd < 0 || inotify_add_watch(fd, dirname(dirCopy), IN_MODIFY |
+                IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO) < 0 )
+    {
+        fprintf(stderr, "ERROR:  Cannot watch %s\n", location);
+        return(1);
+    }
+
+    fflush(stdout);
+    previous = total;
+
+    while( (len = read(fd, events, sizeof(events))) > 0 ||
+            (len < 0 && errno == EINTR) )
+    {
+        changed = 0;
+        for( char *ptr = events; ptr < events + len;
+                ptr += sizeof(struct inotify_event) + event->len )
+        {
+            event = (const struct inotify_event *)ptr;
+            if( event->len > 0 && strcmp(event->name, baseName) == 0 )
+                changed = 1;
+        }
+
+        /*  A file that's gone missing (mid-rotation, say) is just skipped */
+        if( changed && ttab_sum_incremental(location, NULL, &total) == 0 &&
+                total != previous )
+        {
+            truncate_zeroes( total );
+            fflush(stdout);
+            previous = total;
+        }
+    }
+
+    close(fd);
+    return(0);
+#else
+    (void)previous;
+    fprintf(stderr, "ERROR:  --watch is only supported on Linux\n");
+    return(1);
+#endif
+}
+
+
+/*
+ * Reads a whole, non-negative number given to an option.  Returns -1 if it
+ * isn't one (trailing junk included), so that the range checks throw it out.
+ */
+long parse_count(const char *text)
+{
+    char *end = NULL;
+    long value = 0;
+
+    errno = 0;
+    value = strtol(text, &end, 10);
+    if( end == text || *end != '\0' || errno == ERANGE || value < 0 )
+        return(-1);
+
+    return(value);
+}
+
+
+/*
+ * Compiles a --map (or, with 'filter' set, --filter) expression onto the end
+ * of the transform, bailing out if it doesn't make sense
+ */
+void add_transform(const char *expr, int filter)
+{
+    if( transform == NULL && (transform = ttab_transform_new()) == NULL )
+        mem_error("function:  add_transform");
+
+    if( ttab_transform_add(transform, expr, filter) != 0 )
+    {
+        if( errno == ENOMEM )
+            mem_error("function:  add_transform");
+
+        fprintf(stderr, "ERROR:  Cannot make sense of expression:  %s\n",
+                expr);
+        ttab_transform_free(transform);
+        exit(1);
+    }
+}
+
+
+/*
+ * Opens up the logs named on the command line and hands them to
+ * ttab_merge_logs.  Output goes to outputLocation, or stdout if that's NULL.
+ * Returns 0 on success, 1 if something couldn't be opened.
+ */
+int merge_logs(char **inputs, int numInputs, const char *outputLocation)
+{
+    FILE **files = NULL;
+    FILE *out = stdout;
+    int status = 0;
+
+    files = calloc( numInputs, sizeof(FILE *) );
+    if( files == NULL )
+        mem_error("function:  merge_logs");
+
+    for( int i = 0; i < numInputs; ++i )
+    {
+        files[i] = fopen(inputs[i], "r");
+        if( files[i] == NULL )
+        {
+            fprintf(stderr, "ERROR:  Cannot open file for reading:  %s\n",
+                    inputs[i]);
+            status = 1;
+        }
+    }
+
+    if( status == 0 && outputLocation != NULL )
+    {
+        out = fopen(outputLocation, "w");
+        if( out == NULL )
+        {
+            fprintf(stderr, "ERROR:  Cannot open file for writing:  %s\n",
+                    outputLocation);
+            status = 1;
+        }
+    }
+
+    if( status == 0 )
+    {
+        if( ttab_merge_logs(files, numInputs, out) != 0 )
+        {
+            if( errno == ENOMEM )
+                mem_error("function:  merge_logs");
+
+            fprintf(stderr, "ERROR:  Cannot merge logs:  %s\n",
+                    strerror(errno));
+            status = 1;
+        }
+
+        /*  A full disk might not show up until the last of it is written */
+        if( out != stdout && fclose(out) != 0 && status == 0 )
+        {
+            fprintf(stderr, "ERROR:  Cannot write to %s:  %s\n",
+                    outputLocation, strerror(errno));
+            status = 1;
+        }
+
+        if( out != stdout && status == 0 )
+            printf("Log written to %s\n", outputLocation);
+    }
+
+    for( int i = 0; i < numInputs; ++i )
+    {
+        if( files[i] != NULL )
+            fclose(files[i]);
+    }
+    free(files);
+
+    return(status);
+}
+
+
 void clear_register(double *current)
 {
-    *current = total * -1;
-    add_to_undo( current, 'R' );
-    total -= total;
+    *current = ttab_session_total(session) * -1;
+    if( ttab_session_clear(session) != 0 )
+        mem_error("function:  clear_register");
 }
 
 
 double* get_entered(double *current)
 {
+    const struct ttab_action *history = ttab_session_last(session);
     double temp = 0;
     char lineFront = 0;
     char lineBack = 0;
@@ -478,10 +774,13 @@ double* get_entered(double *current)
         return(current);
     }
 
-    /*  Show running log (history) */
+    /*  Show running log (history), or only the last N entries of it */
     if( line[0] == 'l' || line[0] == '*' )
     {
-        print_log(NULL);
+        size_t last = 0;
+        sscanf(line, "%*s %zu", &last);
+
+        show_log(last);
         *current = 0;
         return(current);
     }
@@ -610,7 +909,9 @@ double* get_entered(double *current)
                         Cannot assign memory for saveLocation");
             }
 
-            sprintf(saveLocation, "ttab_%s.log", get_date_string(1));
+            char dateString[ TTAB_DATE_STRING_LEN ];
+            ttab_date_string(dateString, sizeof(dateString), 1);
+            sprintf(saveLocation, "ttab_%s.log", dateString);
 
             save_file(saveLocation);
         }
@@ -644,173 +945,226 @@ double* get_entered(double *current)
 }
 
 
-char* get_date_string(char quickSaving)
+void do_math(double *current)
 {
-    /*  Generate time */
-    time_t rawTime;
-    time(&rawTime);
+    if( ttab_session_add(session, *current, mode) != 0 )
+        mem_error("function:  do_math");
+}
 
-    /*  Put it into a struct we can use */
-    struct tm *theTime;
-    theTime = localtime(&rawTime);
 
-    /*  Create a string pointer, allocate memory to it, null it out */
-    char *theString = NULL;
-    theString = malloc(DATE_STRING_LEN);
-    if( theString == NULL )
-        mem_error("function:  get_date_string");
-    memset(theString, '\0', DATE_STRING_LEN);
+void undo_prev(void)
+{
+    double number = 0;
 
-    /*  Fill our date string using sprintf */
-    if( quickSaving == 1 )
+    /*  Check to make sure we have a previous operation to reverse */
+    if( ttab_session_undo(session, &number) )
     {
-        sprintf(theString, "%02d-%02d-%02d_%02d-%02d-%02d",
-                theTime->tm_year+1900, theTime->tm_mon+1, theTime->tm_mday,
-                theTime->tm_hour, theTime->tm_min, theTime->tm_sec);
-    }
-    else
-    {
-        sprintf(theString, "%02d-%02d-%02d  %02d:%02d:%02d",
-                theTime->tm_year+1900, theTime->tm_mon+1, theTime->tm_mday,
-                theTime->tm_hour, theTime->tm_min, theTime->tm_sec);
+        /*  Print the undo string */
+        printf("\nUNDO\t( ");
+        if( number > 0 )
+            printf("%g )\n\n", number * -1 );    //  Print negative no.
+        else
+            printf("+%g )\n\n", number * -1 );   //  Print positive no.
     }
-
-    /*  Return pointer */
-    return( theString );
 }
 
 
-void add_to_undo(double *current, char cc)
+/*  Free allocated memory, null out pointers */
+void clean_up(void)
 {
-    /*  Create our history node */
-    struct action *temp = create_node();
-
-    temp->number = *current;        //  The number added during operation
-    temp->runningTotal = total;     //  Total after operation
-
-    /*  Getting our date / time */
-    char *dateString = get_date_string(0);
-    strncpy(temp->date, dateString, DATE_STRING_LEN);
-    free(dateString);
-    dateString = NULL;
-
-    /*  Comment code, see struct definition for codes */
-    temp->commentCode = cc;
-
-    /*  Swap our nodes around */
-    temp->prev = history;
-    history->next = temp;
-    history = temp;
+    ttab_session_free(session);
+    session = NULL;
 
+    free(saveLocation);
+    saveLocation = NULL;
 }
 
 
-void do_math(double *current)
-{
-    switch( mode )
-    {
-        /*
-         * EXPLICIT SUBTRACTION
-         *  Normally, a number can just be added to the total; when the minus
-         *  sign is to the right of the number, though, we have to do it
-         *  manually
-         */
-        case '-':
-            total -= *current;
-            add_to_undo( current, 's' );
-            break;
-        default:
-            total += *current;
-            if( *current < 0 )
-                add_to_undo( current, 's' );
-            else if( *current > 0 )
-                add_to_undo( current, 'a' );
-            break;
-    }
-}
-
 
-void undo_prev(void)
+int main(int argc, char *argv[])
 {
-    /*  Check to make sure we have a previous node to fall back to */
-    if( history->prev != NULL )
-    {
-        /*  Reverse previous arithmetic */
-        total -= history->number;
 
-        /*  Print the undo string */
-        printf("\nUNDO\t( ");
-        if( history->number > 0 )
-            printf("%g )\n\n", (history->number) * -1 );  //  Print negative no.
+    char *outputLocation = NULL;
+    char *from = NULL;
+    char *to = NULL;
+    long windowCount = 0;
+    long windowSeconds = 0;
+    long every = 1;
+    int binaryType = 0;
+    int byteOrder = TTAB_ORDER_NATIVE;
+    char merging = 0;
+    char windowing = 0;
+    char incremental = 0;
+    char watching = 0;
+    int numInputs = 0;
+    int status = 0;
+
+    /*  Anything that isn't an option gets shuffled down to the front of argv */
+    for( int i = 1; i < argc; ++i )
+    {
+        if( strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 )
+        {
+            print_help();
+            return(0);
+        }
+        else if( strcmp(argv[i], "-V") == 0 ||
+                strcmp(argv[i], "--version") == 0 )
+        {
+            print_version_info();
+            return(0);
+        }
+        else if( strcmp(argv[i], "--merge") == 0 )
+            merging = 1;
+        else if( strcmp(argv[i], "-o") == 0 && i + 1 < argc )
+            outputLocation = argv[++i];
+        else if( strcmp(argv[i], "--from") == 0 && i + 1 < argc )
+            from = argv[++i];
+        else if( strcmp(argv[i], "--to") == 0 && i + 1 < argc )
+            to = argv[++i];
+        else if( strcmp(argv[i], "--window") == 0 && i + 1 < argc )
+        {
+            windowCount = parse_count(argv[++i]);
+            windowing = 1;
+        }
+        else if( strcmp(argv[i], "--window-time") == 0 && i + 1 < argc )
+        {
+            windowSeconds = parse_count(argv[++i]);
+            windowing = 1;
+        }
+        else if( strcmp(argv[i], "--every") == 0 && i + 1 < argc )
+            every = parse_count(argv[++i]);
+        else if( strncmp(argv[i], "--binary=", 9) == 0 )
+            binaryType = ttab_binary_type(argv[i] + 9);
+        else if( strcmp(argv[i], "--endian=little") == 0 )
+            byteOrder = TTAB_ORDER_LITTLE;
+        else if( strcmp(argv[i], "--endian=big") == 0 )
+            byteOrder = TTAB_ORDER_BIG;
+        else if( strcmp(argv[i], "--endian=native") == 0 )
+            byteOrder = TTAB_ORDER_NATIVE;
+        else if( strcmp(argv[i], "--incremental") == 0 )
+            incremental = 1;
+        else if( strcmp(argv[i], "--watch") == 0 )
+            watching = 1;
+        else if( strcmp(argv[i], "--map") == 0 && i + 1 < argc )
+            add_transform(argv[++i], 0);
+        else if( strcmp(argv[i], "--filter") == 0 && i + 1 < argc )
+            add_transform(argv[++i], 1);
         else
-            printf("+%g )\n\n", (history->number) * -1 ); //  Print positive no.
-        
-        history = history->prev;    //  Assign current history to previous node
-        free(history->next);        //  Free memory allocated to node
-        history->next = NULL;       //  Null out the pointer
+            argv[numInputs++] = argv[i];
     }
-}
-
 
-/*  Free allocated memory, null out pointers */
-void clean_up(void)
-{
     /*
-     * Here we step back through the history, node by node, until we get to the
-     * original.  At each node, we free the allocated space and null the pointer
-     * from which we just arrived
+     * Only one mode at a time, and no options that belong to some other mode;
+     * otherwise whichever came first below would quietly win
      */
-    while( history->prev != NULL )
+    if( merging + (from != NULL || to != NULL) + windowing +
+            (binaryType != 0) + (incremental || watching) > 1 ||
+            (outputLocation != NULL && !merging) ||
+            (every != 1 && !windowing) ||
+            (byteOrder != TTAB_ORDER_NATIVE && binaryType == 0) )
     {
-        history = history->prev;
-        free( history->next );
-        history->next = NULL;
+        print_usage();
+        ttab_transform_free(transform);
+        return(1);
     }
 
-    /*  Free the final node (both *history and *undo point to same address ) */
-    free(history);
+    /*
+     * Transforms only go between reading text and summing it; merged logs,
+     * indexed ranges, binary input and cached totals never see single numbers
+     */
+    if( transform != NULL && (merging || from != NULL || to != NULL ||
+                binaryType != 0 || incremental || watching || numInputs != 1) )
+    {
+        fprintf(stderr, "ERROR:  --map and --filter only work when summing "
+                "a single file or stdin\n");
+        ttab_transform_free(transform);
+        return(1);
+    }
 
-    /*  Finally, null out our pointers */
-    history = NULL;
-    undo = NULL;
-}
+    /*  Merge mode:  ttab --merge FILE [FILE ...] [-o OUTPUT] */
+    if( merging )
+    {
+        if( numInputs == 0 )
+        {
+            print_usage();
+            return(1);
+        }
 
+        return( merge_logs(argv, numInputs, outputLocation) );
+    }
 
+    /*  Time range:  ttab [--from TIME] [--to TIME] FILE */
+    if( from != NULL || to != NULL )
+    {
+        if( numInputs != 1 )
+        {
+            print_usage();
+            return(1);
+        }
 
-int main(int argc, char *argv[])
-{
+        return( range_total(argv[0], from, to) );
+    }
 
-    if( argc > 2 )
+    /*  Sliding window:  ttab --window N | --window-time T [--every K] - */
+    if( windowing )
     {
-        print_usage();
-        return(1);
+        if( numInputs != 1 || strcmp(argv[0], "-") != 0 || every < 1 ||
+                every > MAX_EVERY || windowCount < 0 || windowSeconds < 0 ||
+                windowCount > MAX_WINDOW_SLOTS ||
+                windowSeconds > MAX_WINDOW_SLOTS ||
+                (windowCount > 0) == (windowSeconds > 0) )
+        {
+            print_usage();
+            return(1);
+        }
+
+        status = sum_window_stdin(windowCount, windowSeconds, every);
+        ttab_transform_free(transform);
+        return(status);
     }
-    else if( argc == 2 )
-    {
 
-        if( strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0 )
+    /*  Binary input:  ttab --binary=TYPE [--endian=ORDER] FILE */
+    if( binaryType != 0 )
+    {
+        if( binaryType < 0 || numInputs != 1 )
         {
-            print_help();
-            return(0);
+            print_usage();
+            return(1);
         }
 
-        if( strcmp(argv[1], "-V") == 0 || strcmp(argv[1], "--version") == 0 )
+        return( sum_binary(argv[0], binaryType, byteOrder) );
+    }
+
+    /*  Incremental:  ttab --incremental | --watch FILE */
+    if( incremental || watching )
+    {
+        if( numInputs != 1 || strcmp(argv[0], "-") == 0 )
         {
-            print_version_info();
-            return(0);
+            print_usage();
+            return(1);
         }
 
-        if( strcmp(argv[1], "-") == 0 )
+        return( sum_incremental(argv[0], watching) );
+    }
+
+    if( numInputs > 1 )
+    {
+        print_usage();
+        return(1);
+    }
+    else if( numInputs == 1 )
+    {
+        if( strcmp(argv[0], "-") == 0 )
         {
-            sum_log_stdin();
+            status = sum_log_stdin();
         }
         else
         {
-            FILE *fp = fopen(argv[1], "r");
+            FILE *fp = fopen(argv[0], "r");
             if( fp == NULL )
             {
                 fprintf(stderr, "ERROR:  Cannot open file for writing: %s\n",
-                        argv[1]);
+                        argv[0]);
                 printf("\n");
                 print_usage();
                 printf("\n");
@@ -818,24 +1172,23 @@ int main(int argc, char *argv[])
                 return(1);
             }
 
-            sum_log(fp);
+            status = sum_log(fp, argv[0]);
             fclose(fp);
         }
 
-        return(0);
+        ttab_transform_free(transform);
+        return(status);
     }
 
 
     /*  Initialize some numbers */
-    total = 0;
     entered = 0;
     double *current = &entered;
 
-    /*  Initialize the history nodes */
-    undo = create_node();
-    history = create_node();
-    undo->next = history;
-    history->prev = undo;
+    /*  Start up a fresh session (total and history) */
+    session = ttab_session_new();
+    if( session == NULL )
+        mem_error("function:  main");
 
     /*  Init saveLocation */
     saveLocation = NULL;
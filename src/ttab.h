@@ -0,0 +1,215 @@
+/*******************************************************************************
+ * ttab.h   |   v 0.96  |   GPL v 3     |   2026-10-18
+ * James Hendrie        |   hendrie dot james at gmail dot com
+ *
+ *      Public interface to libttab, the summing and history engine behind the
+ *      ttab program.  Everything here is reentrant:  all state lives in the
+ *      parser and session handles, so a caller can keep as many of them going
+ *      at once as it likes (one per thread, one per buffer, whatever).
+ *
+ *      Functions that can fail return 0 on success and -1 on failure (which,
+ *      short of a bad argument, means we ran out of memory).
+*******************************************************************************/
+#ifndef TTAB_H
+#define TTAB_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+
+#define TTAB_VERSION "0.96"
+
+#define TTAB_DATE_STRING_LEN 25
+
+
+/*  Input formats, as reported by ttab_detect_format and the parser */
+#define TTAB_FORMAT_PLAIN 0     //  Whitespace-separated numbers
+#define TTAB_FORMAT_LOG 1       //  A log written by ttab_session_write_log
+
+/*  Record types and byte orders for binary input */
+#define TTAB_BINARY_F64 1       //  IEEE 754 doubles
+#define TTAB_BINARY_F32 2       //  IEEE 754 floats
+#define TTAB_BINARY_I64 3       //  64-bit two's complement integers
+#define TTAB_BINARY_I32 4       //  32-bit two's complement integers
+
+#define TTAB_ORDER_NATIVE 0
+#define TTAB_ORDER_LITTLE 1
+#define TTAB_ORDER_BIG 2
+
+
+struct ttab_action {
+    double number;              //  Number added / subtracted / whatever
+    double runningTotal;        //  Running total after operation
+
+    char date[TTAB_DATE_STRING_LEN];    //  Date at which it was performed
+
+    /*
+     * Single-character comment code.
+     *
+     * 'R' = register reset
+     * 'L' = clear log
+     * 'A' = clear all (register and total)
+     *
+     * 'w' = write file
+     * 'l' = load file
+     *
+     * 'a' = number added
+     * 's' = number subtracted
+     * 'u' = undo operation
+     *
+     * Any other character code(s) will result in no comment being added (0)
+     *
+     */
+    char commentCode;
+
+    struct ttab_action *next;   //  Our next node pointer
+    struct ttab_action *prev;   //  Our previous node pointer
+};
+
+
+struct ttab_parser;
+struct ttab_session;
+struct ttab_window;
+struct ttab_transform;
+
+/*  Gets handed each number the parser reads, along with the caller's data */
+typedef void (*ttab_sink)(void *data, double value);
+
+
+/*******************************************************************************
+ *                          SUMMING
+*******************************************************************************/
+
+/*
+ * Streaming parser.  Feed it input in chunks of any size (lines may straddle
+ * chunks) and call ttab_parser_finish once the input runs out to pick up a
+ * final line with no newline on the end.  Comments ('#' to end of line) are
+ * ignored, and a ttab log header switches the parser over to log format.
+ */
+struct ttab_parser* ttab_parser_new(void);
+int ttab_parser_feed(struct ttab_parser *parser, const char *buf, size_t len);
+void ttab_parser_finish(struct ttab_parser *parser);
+double ttab_parser_total(const struct ttab_parser *parser);
+int ttab_parser_format(const struct ttab_parser *parser);
+void ttab_parser_free(struct ttab_parser *parser);
+void ttab_parser_set_sink(struct ttab_parser *parser, ttab_sink sink,
+        void *data);
+void ttab_parser_set_transform(struct ttab_parser *parser,
+        const struct ttab_transform *transform);
+
+/*  One-shot helpers built on the parser */
+int ttab_sum_buffer(const char *buf, size_t len, double *total);
+int ttab_sum_file(FILE *fp, double *total);
+int ttab_sum_fd(int fd, double *total);
+int ttab_sum_fd_transformed(int fd, const struct ttab_transform *transform,
+        double *total);
+int ttab_detect_format(const char *buf, size_t len);
+
+/*
+ * Transforms:  a chain of expressions in x that each number is put through
+ * before it's summed.  A map (filter == 0) replaces the number with the
+ * expression's value; a filter drops the number if the value is 0.  Stages
+ * run in the order they were added.  ttab_transform_add returns -1 with errno
+ * set to EINVAL if the expression doesn't parse (or nests more than 64 deep).
+ */
+struct ttab_transform* ttab_transform_new(void);
+int ttab_transform_add(struct ttab_transform *transform, const char *expr,
+        int filter);
+void ttab_transform_free(struct ttab_transform *transform);
+
+/*
+ * Incremental summing of a file that only ever grows:  a small cache kept in
+ * 'cacheDir' (NULL for $XDG_CACHE_HOME/ttab or ~/.cache/ttab) remembers how
+ * far we got last time, so only what's been added since gets read.  If the
+ * file was truncated or replaced, it's read again from the top.
+ */
+int ttab_sum_incremental(const char *path, const char *cacheDir,
+        double *total);
+
+/*
+ * Binary input:  raw records of one type, summed with SIMD where the CPU has
+ * it.  Bytes at the end that don't make up a whole record are left out of
+ * the total, and their count is handed back through 'leftover'.
+ * ttab_binary_type turns "f64", "f32", "i64" or "i32" into a type (or -1).
+ */
+int ttab_binary_type(const char *name);
+int ttab_binary_width(int type);
+int ttab_sum_binary_buffer(const void *buf, size_t len, int type,
+        int byteOrder, double *total, size_t *leftover);
+int ttab_sum_binary_fd(int fd, int type, int byteOrder, double *total,
+        size_t *leftover);
+
+
+/*
+ * Sliding windows:  the total of the last 'count' numbers, or (if count is 0)
+ * of the numbers added over the last 'seconds' seconds.  Adding a number is
+ * O(1) and memory is fixed by the size of the window.  'now' is only used by
+ * time windows; ttab_window_advance lets them catch up while nothing is
+ * being added.
+ */
+struct ttab_window* ttab_window_new(size_t count, unsigned int seconds);
+void ttab_window_add(struct ttab_window *window, double value, time_t now);
+void ttab_window_advance(struct ttab_window *window, time_t now);
+double ttab_window_total(const struct ttab_window *window);
+void ttab_window_free(struct ttab_window *window);
+
+
+/*******************************************************************************
+ *                          SESSIONS
+*******************************************************************************/
+
+/*
+ * A session is a running total plus the history of how it got there, i.e.
+ * everything behind the interactive adding machine.  'mode' for
+ * ttab_session_add is '-' to subtract the number, anything else to add it.
+ */
+struct ttab_session* ttab_session_new(void);
+void ttab_session_free(struct ttab_session *session);
+double ttab_session_total(const struct ttab_session *session);
+const struct ttab_action* ttab_session_last(const struct ttab_session *session);
+int ttab_session_add(struct ttab_session *session, double number, char mode);
+int ttab_session_clear(struct ttab_session *session);
+int ttab_session_undo(struct ttab_session *session, double *undone);
+
+/*
+ * Writes the history to 'fd':  only the last 'last' entries, or all of it if
+ * 'last' is 0.  ttab_session_log_lines says how many lines that would take
+ * (for deciding whether it needs a pager), and ttab_session_write_log writes
+ * the whole thing as a ttab log, header and all.  Both writers return 0, or
+ * -1 if a write failed (errno says why).
+ */
+int ttab_session_print_log(const struct ttab_session *session, size_t last,
+        int fd);
+size_t ttab_session_log_lines(const struct ttab_session *session, size_t last);
+int ttab_session_write_log(const struct ttab_session *session, int fd);
+
+
+/*******************************************************************************
+ *                          LOGS
+*******************************************************************************/
+
+/*
+ * Merges ttab logs into one chronological log written to 'out', recomputing
+ * the running totals.  Only one entry per input is held in memory.  Returns
+ * 0, or -1 with errno set if reading an input or writing 'out' failed.
+ */
+int ttab_merge_logs(FILE **inputs, int numInputs, FILE *out);
+
+/*
+ * Total of the entries in a saved log dated from 'from' through 'to' (either
+ * can be NULL to leave that end open).  Times are 'YYYY-MM-DD HH:MM[:SS]',
+ * 'YYYY-MM-DD' or 'HH:MM[:SS]', the last meaning on the day the log starts.
+ * Uses (and if need be writes) a checkpoint index in LOG.idx.  On failure,
+ * errno is EINVAL for a bad time, otherwise whatever went wrong reading.
+ */
+int ttab_range_total(const char *logPath, const char *from, const char *to,
+        double *total);
+
+/*
+ * Fills 'buf' with the current local date and time, either as it appears in
+ * logs (quickSaving == 0) or in the form used for quicksave file names
+ */
+void ttab_date_string(char *buf, size_t size, int quickSaving);
+
+
+#endif
@@ -0,0 +1,51 @@
+/*******************************************************************************
+ * ttab_internal.h
+ *
+ *      Pieces shared between the libttab source files that aren't part of the
+ *      public interface in ttab.h.
+*******************************************************************************/
+#ifndef TTAB_INTERNAL_H
+#define TTAB_INTERNAL_H
+
+#include <sys/types.h>
+
+#include "ttab.h"
+
+#define TTAB_MAX_STRING_LEN 80
+#define TTAB_ENTRY_MAX_LINES 4
+
+#define TTAB_LOG_SEPARATOR "----------------------------------------"
+#define TTAB_LOG_HEADER_LEN 160
+
+/*  How many numbers the parser hands a transform at once */
+#define TTAB_TRANSFORM_BATCH 256
+
+
+/*
+ * One entry read back out of a saved ttab log:  every line belonging to a
+ * single operation, minus its 'Total:' line (which gets recomputed whenever
+ * the entry is written out again).
+ */
+struct ttab_log_entry {
+    char date[TTAB_DATE_STRING_LEN];                        //  Timestamp
+    char lines[TTAB_ENTRY_MAX_LINES][TTAB_MAX_STRING_LEN];  //  Verbatim
+    int numLines;                                           //  How many kept
+    double number;                                          //  Net change
+    off_t offset;                                           //  Where it began
+};
+
+
+int ttab_read_log_entry(FILE *fp, off_t *position,
+        struct ttab_log_entry *entry);
+void ttab_format_log_header(char *buf, size_t size);
+void ttab_write_log_header(FILE *fp);
+size_t ttab_read_block_size(int fd);
+
+size_t ttab_transform_apply(const struct ttab_transform *transform,
+        double *values, size_t count);
+
+int ttab_parser_save_state(const struct ttab_parser *parser, FILE *fp);
+int ttab_parser_load_state(struct ttab_parser *parser, FILE *fp);
+
+
+#endif
@@ -0,0 +1,177 @@
+/*******************************************************************************
+ * window.c
+ *
+ *      Sliding-window totals for streams that never end:  the sum of the last
+ *      N numbers, or of everything that came in over the last T seconds.
+ *
+ *      Numbers are added to and taken out of the running sum one at a time,
+ *      with compensated (Neumaier) summation so the rounding error doesn't
+ *      pile up.  On top of that the sum is recomputed from scratch once per
+ *      trip around the ring, which costs O(1) per number spread out over the
+ *      trip, and means that after days of uptime the total is still only as
+ *      far off as one window's worth of arithmetic can make it.
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ttab_internal.h"
+
+
+struct ttab_window {
+    double *slots;          //  Numbers (count windows), per-second sums (time)
+    size_t numSlots;
+    size_t next;            //  Count windows:  the slot the next number goes in
+    size_t filled;          //  Count windows:  how many slots are in use
+    char timed;
+
+    time_t latest;          //  Time windows:  the newest second in the window
+    size_t sinceRecompute;  //  Time windows:  seconds since the last recompute
+
+    double sum;             //  Running sum...
+    double compensation;    //  ...and the low-order bits it couldn't hold
+};
+
+
+/*  Neumaier's version of Kahan summation, which copes with big subtractions */
+static void compensated_add(struct ttab_window *window, double value)
+{
+    double temp = window->sum + value;
+
+    if( fabs(window->sum) >= fabs(value) )
+        window->compensation += (window->sum - temp) + value;
+    else
+        window->compensation += (value - temp) + window->sum;
+
+    window->sum = temp;
+}
+
+
+/*  Throws away the running sum and adds up whatever's in the window again */
+static void recompute(struct ttab_window *window)
+{
+    size_t inUse = window->timed ? window->numSlots : window->filled;
+
+    window->sum = 0;
+    window->compensation = 0;
+    for( size_t i = 0; i < inUse; ++i )
+        compensated_add(window, window->slots[i]);
+
+    window->sinceRecompute = 0;
+}
+
+
+struct ttab_window* ttab_window_new(size_t count, unsigned int seconds)
+{
+    struct ttab_window *window = NULL;
+
+    if( (count == 0) == (seconds == 0) )
+        return(NULL);
+
+    window = malloc( sizeof(struct ttab_window) );
+    if( window == NULL )
+        return(NULL);
+
+    window->timed = (count == 0);
+    window->numSlots = window->timed ? seconds : count;
+    window->slots = calloc(window->numSlots, sizeof(double));
+    if( window->slots == NULL )
+    {
+        free(window);
+        return(NULL);
+    }
+
+    window->next = 0;
+    window->filled = 0;
+    window->latest = 0;
+    window->sinceRecompute = 0;
+    window->sum = 0;
+    window->compensation = 0;
+
+    return(window);
+}
+
+
+void ttab_window_free(struct ttab_window *window)
+{
+    if( window == NULL )
+        return;
+
+    free(window->slots);
+    free(window);
+}
+
+
+double ttab_window_total(const struct ttab_window *window)
+{
+    return( window->sum + window->compensation );
+}
+
+
+/*
+ * Moves a time window up to 'now', dropping the seconds that fall out of it.
+ * Time running backwards (the clock being set, say) is ignored.
+ */
+void ttab_window_advance(struct ttab_window *window, time_t now)
+{
+    size_t slot = 0;
+
+    if( !window->timed )
+        return;
+
+    if( window->latest == 0 || now <= window->latest )
+    {
+        if( window->latest == 0 )
+            window->latest = now;
+        return;
+    }
+
+    /*  Nothing at all for a whole window:  start over */
+    if( (unsigned long long)(now - window->latest) >= window->numSlots )
+    {
+        memset(window->slots, 0, window->numSlots * sizeof(double));
+        window->sum = 0;
+        window->compensation = 0;
+        window->sinceRecompute = 0;
+        window->latest = now;
+        return;
+    }
+
+    while( window->latest < now )
+    {
+        ++(window->latest);
+        slot = (size_t)(window->latest % window->numSlots);
+
+        compensated_add(window, -window->slots[slot]);
+        window->slots[slot] = 0;
+        ++(window->sinceRecompute);
+    }
+
+    if( window->sinceRecompute >= window->numSlots )
+        recompute(window);
+}
+
+
+void ttab_window_add(struct ttab_window *window, double value, time_t now)
+{
+    if( window->timed )
+    {
+        ttab_window_advance(window, now);
+        window->slots[ window->latest % window->numSlots ] += value;
+        compensated_add(window, value);
+        return;
+    }
+
+    /*  Once the ring is full, the oldest number makes way for the new one */
+    if( window->filled == window->numSlots )
+        compensated_add(window, -window->slots[ window->next ]);
+    else
+        ++(window->filled);
+
+    window->slots[ window->next ] = value;
+    compensated_add(window, value);
+
+    window->next = (window->next + 1) % window->numSlots;
+    if( window->next == 0 )
+        recompute(window);
+}